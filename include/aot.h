@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "common.h"
+
+class CPU;
+
+/*
+ * Support for ROMs that were translated ahead of time into C++ by the chip8-aot tool.
+ *
+ * The tool emits one function per basic block. A block only contains instructions that work
+ * on registers, the index and the stack, so everything else (drawing, timers, keys, memory
+ * writes) is left to the interpreter just like anything the tool couldn't reach statically,
+ * e.g. the targets of BNNN jumps.
+ */
+
+/* Longest block the tool will emit. This bounds how far back invalidation has to look. */
+#define CHIP8_AOT_MAX_BLOCK_INSTRUCTIONS (64)
+
+/* The CPU state a translated block is allowed to touch */
+struct AotContext {
+    uint8_t* V;
+    uint16_t* stack;
+    uint16_t& sp;
+    uint16_t& index;
+    uint16_t& pc;
+};
+
+struct AotBlock {
+    uint16_t start; /* Address of the first instruction */
+    uint16_t end;   /* One past the last byte of the last instruction */
+    uint16_t count; /* Number of instructions executed */
+    void (*run)(AotContext& context);
+};
+
+struct AotProgram {
+    const uint8_t* rom; /* The ROM this program was translated from */
+    size_t romSize;
+    const AotBlock* blocks;
+    size_t blockCount;
+};
+
+/* Executes a translated program, falling back to the interpreter wherever there's no block */
+class AotRuntime {
+public:
+    explicit AotRuntime(const AotProgram& program);
+
+    /* Whether the program was translated from exactly the ROM loaded into 'memory' */
+    bool matches(const uint8_t* memory) const;
+
+    /* Executes up to 'cycles' instructions on 'cpu' and returns how many ran */
+    uint32_t run(CPU& cpu, uint32_t cycles);
+
+    /* Stops using every block that was translated from [address, address + length) */
+    void invalidate(uint16_t address, uint16_t length);
+
+private:
+    const AotProgram& program;
+    const AotBlock* blocks[CHIP8_MEMORY_SIZE];
+};
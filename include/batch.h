@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cpu.h"
+
+/*
+ * Runs many ROMs headless at once, one CPU per job.
+ *
+ * Jobs are spread over a pool of worker threads. Each worker has its own queue and once it
+ * runs dry it steals from the others, so a few long jobs don't leave the rest of the
+ * machine idle.
+ */
+
+struct BatchOptions {
+    Engine engine;
+    uint64_t cycles;      /* Instructions each job may execute */
+    uint32_t instructionsPerFrame; /* Instructions per 60 Hz timer tick */
+    uint32_t timeLimitMs; /* Wall clock each job may take, 0 for no limit */
+    unsigned threads;     /* Worker threads, 0 to use every core */
+    uint64_t seed;        /* Random number seed of each ROM's first job */
+    uint32_t seedsPerRom; /* Jobs per ROM, each seeded one higher than the last */
+};
+
+/* Why a job stopped */
+enum class BatchExit {
+    Cycles,    /* It executed all of its cycles */
+    Time,      /* It ran out of time */
+    KeyWait,   /* It stopped in FX0A, waiting for a key nobody will press */
+    LoadError, /* The ROM couldn't be read */
+    Error      /* Running it threw, e.g. because memory ran out */
+};
+
+struct BatchResult {
+    std::string romPath;
+    uint64_t seed;
+    BatchExit exit;
+    uint64_t cycles;          /* Instructions executed */
+    uint64_t idleCycles;      /* Of those, how many were skipped in idle loops */
+    uint64_t frames;          /* Frames drawn */
+    uint64_t framebufferHash; /* Hash of the final frame, see hash_framebuffer() */
+    double seconds;           /* Wall clock spent running the job */
+};
+
+/*
+ * Lists the ROMs to run from 'path', which is either a directory (every file in it, sorted by
+ * name) or a text file with one ROM path per line. The same ROM may be listed more than once.
+ */
+std::vector<std::string> list_batch_roms(const char* path);
+
+/* Runs every ROM in 'roms' once per seed and returns the results in the same order, ROM by ROM */
+std::vector<BatchResult> run_batch(const std::vector<std::string>& roms, const BatchOptions& options);
+
+const char* batch_exit_name(BatchExit exit);
@@ -0,0 +1,123 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+/*
+ * The C interface to the emulator core, for embedding it in programs that aren't C++ or that
+ * want a boundary that doesn't change with the CPU class.
+ *
+ * A machine is an opaque handle. Calls are meant to be coarse: run thousands of instructions or
+ * whole frames per call and fetch the screen once per frame, not step single instructions.
+ * A handle may only be used by one thread at a time; different handles are independent.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8 chip8;
+
+typedef enum chip8_status {
+    CHIP8_OK = 0,
+    CHIP8_ERROR_ARGUMENT,      /* A null handle or buffer, or a value out of range */
+    CHIP8_ERROR_ROM_TOO_LARGE, /* The ROM doesn't fit in memory after the interpreter area */
+    CHIP8_ERROR_IO,            /* A file couldn't be read or is empty */
+    CHIP8_ERROR_SNAPSHOT,      /* A snapshot is too small, damaged or from another version */
+    CHIP8_ERROR_MEMORY         /* Out of memory */
+} chip8_status;
+
+typedef enum chip8_engine {
+    CHIP8_ENGINE_SWITCH = 0,
+    CHIP8_ENGINE_THREADED,
+    CHIP8_ENGINE_JIT
+} chip8_engine;
+
+#define CHIP8_SCREEN_WIDTH (64)
+#define CHIP8_SCREEN_HEIGHT (32)
+
+/* Creates a machine with empty memory, the threaded engine where available and seed 0. Returns NULL if out of memory. */
+chip8* chip8_create(void);
+void chip8_destroy(chip8* machine);
+
+/*
+ * Resets the machine and loads a ROM of 'size' bytes at 0x200. The engine, seed and
+ * instructions per frame are kept. On failure the machine is left as it was.
+ */
+chip8_status chip8_load_rom(chip8* machine, const uint8_t* rom, size_t size);
+chip8_status chip8_load_rom_file(chip8* machine, const char* path);
+
+/*
+ * Engines that aren't available in this build fall back to CHIP8_ENGINE_SWITCH. CHIP8_ENGINE_JIT is only
+ * available on x86-64 Linux and FreeBSD, where chip8bench checks it runs the example ROMs fastest.
+ */
+chip8_status chip8_set_engine(chip8* machine, chip8_engine engine);
+
+/* Restarts the random numbers CXNN produces. The seed is also used by later chip8_load_rom() calls. */
+chip8_status chip8_set_seed(chip8* machine, uint64_t seed);
+
+/* Instructions per 60 Hz frame for chip8_run_frame(), 12 unless set */
+chip8_status chip8_set_instructions_per_frame(chip8* machine, uint32_t instructions);
+
+/*
+ * Executes up to 'cycles' instructions without touching the timers and returns how many ran.
+ * Fewer run if the ROM starts waiting for a key with FX0A, see chip8_set_keys().
+ */
+uint64_t chip8_run_cycles(chip8* machine, uint64_t cycles);
+
+/* Events chip8_run_until() can stop at, combine them with | */
+#define CHIP8_RUN_STOP_DRAW     (1 << 0) /* After an instruction changed the screen */
+#define CHIP8_RUN_STOP_KEY_WAIT (1 << 1) /* When FX0A starts waiting for a key. Runs always stop there. */
+#define CHIP8_RUN_STOP_PC       (1 << 2) /* When the pc arrives at an address, before executing it */
+#define CHIP8_RUN_STOP_SOUND    (1 << 3) /* After FX18 starts a sound */
+
+typedef struct chip8_run_result {
+    uint64_t executed; /* Instructions executed */
+    uint32_t event;    /* The CHIP8_RUN_STOP_* event the run stopped at, 0 if the cycles ran out */
+} chip8_run_result;
+
+/*
+ * Like chip8_run_cycles() but stops as soon as one of 'events' happens, so a frontend can run
+ * until the next draw instead of guessing how many instructions that takes. 'pc' is only used
+ * with CHIP8_RUN_STOP_PC. At least one instruction runs before stopping at 'pc'.
+ */
+chip8_status chip8_run_until(chip8* machine, uint32_t events, uint64_t cycles, uint16_t pc,
+                             chip8_run_result* result);
+
+/*
+ * Runs one 60 Hz frame: executes the instructions per frame and counts the timers down once.
+ * Timers keep counting while FX0A waits for a key. Returns the instructions executed.
+ */
+uint64_t chip8_run_frame(chip8* machine);
+
+/* Runs 'frames' frames like chip8_run_frame() in one call */
+uint64_t chip8_run_frames(chip8* machine, uint32_t frames);
+
+/* Sets the keys that are held, bit N for key N. A key going down completes a waiting FX0A. */
+chip8_status chip8_set_keys(chip8* machine, uint16_t keys);
+
+/* Non-zero while FX0A waits for a key */
+int chip8_is_waiting_for_key(const chip8* machine);
+
+/*
+ * Copies the screen to 'rows', one 64-bit word per row with pixel x of a row in bit (63 - x).
+ * Returns a mask with bit N set for every row that changed since the previous call, or 0 if
+ * 'machine' or 'rows' is NULL.
+ */
+uint32_t chip8_get_framebuffer(chip8* machine, uint64_t rows[CHIP8_SCREEN_HEIGHT]);
+
+/* Times the sound timer ran out since the previous call */
+uint32_t chip8_take_beeps(chip8* machine);
+
+/* Bytes chip8_snapshot() needs */
+size_t chip8_snapshot_size(void);
+
+/* Saves the whole machine state to 'buffer' so that chip8_restore() can go back to it */
+chip8_status chip8_snapshot(const chip8* machine, void* buffer, size_t size);
+chip8_status chip8_restore(chip8* machine, const void* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
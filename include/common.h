@@ -1,14 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 
 #ifndef NDEBUG
     #include <cstdio>
 
-
+    /* For cold paths only; what the CPU does per instruction goes through CHIP8_TRACE in trace.h */
     #define LOG_IMPL(func, line, m, ...) \
             do {\
-                std::fprintf(stderr, "[%s:%d] "##m##"\n", reinterpret_cast<const char*>(func), static_cast<int>(line), ##__VA_ARGS__);\
+                std::fprintf(stderr, "[%s:%d] " m "\n", reinterpret_cast<const char*>(func), static_cast<int>(line), ##__VA_ARGS__);\
             } while (0)
 
     #define LOG(m, ...) LOG_IMPL(__FUNCTION__, __LINE__, m, ##__VA_ARGS__)
@@ -17,19 +18,22 @@
 #endif
 
 #define CHIP8_MEMORY_SIZE (0x1000)
+/* Every address, the pc included, wraps around the end of memory */
+#define CHIP8_ADDRESS_MASK (CHIP8_MEMORY_SIZE - 1)
 #define CHIP8_REGISTER_COUNT (16)
 #define CHIP8_STACK_DEPTH (16)
+/* The stack is a ring, calls nested deeper than CHIP8_STACK_DEPTH overwrite the oldest return addresses */
+#define CHIP8_STACK_MASK (CHIP8_STACK_DEPTH - 1)
 #define CHIP8_KEY_COUNT (16)
 #define CHIP8_FONT_COUNT (80)
 
 #define CHIP8_PIXELS_WIDTH (64)
 #define CHIP8_PIXELS_HEIGHT (32)
 
-#define CHIP8_WINDOW_SCALAR (10)
-
-#define CHIP8_WINDOW_WIDTH (CHIP8_PIXELS_WIDTH * CHIP8_WINDOW_SCALAR)
-#define CHIP8_WINDOW_HEIGHT (CHIP8_PIXELS_HEIGHT * CHIP8_WINDOW_SCALAR)
+/* How many window pixels each emulated pixel covers unless --scale says otherwise */
+#define CHIP8_DEFAULT_WINDOW_SCALE (10)
 
 #define CHIP8_START_ADDRESS (0x0200)
 
-using ROM = std::unique_ptr<uint8_t[]>;
\ No newline at end of file
+/* The built in hex digit sprites, loaded at the start of memory */
+extern const uint8_t CHIP8_FONTSET[CHIP8_FONT_COUNT];
\ No newline at end of file
@@ -1,37 +1,54 @@
 #pragma once
 
 #include <cstdio>
-#include <SDL2/SDL.h>
+#include <memory>
 #include "common.h"
+#include "host.h"
+#include "instruction.h"
+#include "profiler.h"
 
-class CPU {
-public:
-    CPU(ROM rom);
-
-    void emulate_cycle();
-    uint16_t next();
-    void decode(uint16_t op);
+class Jit;
+class AotRuntime;
+struct AotProgram;
 
-    void dump();
-    bool needsDraw() const;
+/* The execution cores that can drive the CPU */
+enum class Engine {
+    Switch,   /* Dispatch each instruction through one switch statement */
+    Threaded, /* Jump straight from one handler to the next (GCC/Clang only) */
+    Jit,      /* Translate runs of instructions to native code (x86-64 only) */
+    Aot       /* Run a program translated ahead of time by chip8-aot */
+};
 
-    void setDraw(bool draw);
+/* Events CPU::runUntil() can stop at, combine them with | */
+#define CHIP8_STOP_DRAW     (1 << 0) /* After DXYN or 00E0 changed the screen */
+#define CHIP8_STOP_KEY_WAIT (1 << 1) /* When FX0A starts waiting for a key. Runs always stop there. */
+#define CHIP8_STOP_PC       (1 << 2) /* When the pc arrives at a given address */
+#define CHIP8_STOP_SOUND    (1 << 3) /* After FX18 starts a sound */
 
-    uint8_t* getGFX();
+/* How a run ended */
+struct RunResult {
+    uint64_t executed; /* Instructions executed, including skipped idle loops */
+    uint32_t event;    /* The CHIP8_STOP_* event the run stopped at, 0 if the cycles ran out */
+};
 
-private:
+/*
+ * Everything that makes up the state of a running machine. This is plain old data so that a
+ * snapshot is a single copy of the whole block, see CPU::save() and CPU::load().
+ */
+struct CPUState {
     uint8_t memory[CHIP8_MEMORY_SIZE]; /* Available memory */
 
-    uint8_t gfx[CHIP8_PIXELS_WIDTH * CHIP8_PIXELS_HEIGHT]; /* Graphics memory */
+    uint64_t gfx[CHIP8_PIXELS_HEIGHT]; /* Graphics memory, one bit per pixel */
 
-    uint8_t key[CHIP8_KEY_COUNT]; /* HEX-based keypad (0x0 - 0xF) */
     uint8_t V[CHIP8_REGISTER_COUNT]; /* Registers 0-15 and carry */
 
+    uint16_t keys; /* HEX-based keypad (0x0 - 0xF), bit N is set while key N is held */
+    bool waiting_for_key; /* Set while FX0A waits for a key to be pressed */
+
     /* Stack and stack pointer for CALL routines */
     uint16_t stack[CHIP8_STACK_DEPTH];
     uint16_t sp;
 
-    uint16_t opcode; /* The current opcode we're processing */
     uint16_t index; /* Index register */
     uint16_t pc; /* Program counter */
 
@@ -42,22 +59,164 @@ private:
     uint8_t delay_timer;
     uint8_t sound_timer;
 
-    bool need_draw;
-
-    void processF(uint16_t op);
-    void processE(uint16_t op);
-    void processD(uint16_t op);
-    void processC(uint16_t op);
-    void processB(uint16_t op);
-    void processA(uint16_t op);
-    void process9(uint16_t op);
-    void process8(uint16_t op);
-    void process7(uint16_t op);
-    void process6(uint16_t op);
-    void process5(uint16_t op);
-    void process4(uint16_t op);
-    void process3(uint16_t op);
-    void process2(uint16_t op);
-    void process1(uint16_t op);
-    void process0(uint16_t op);
+    uint32_t dirty_rows; /* Rows drawn since the screen was last shown, see framebuffer.h */
+
+    uint64_t rng; /* Random number generator state for CXNN, see rng.h */
+};
+
+class CPU : private CPUState {
+public:
+    /*
+     * A machine with the 'size' bytes at 'rom' loaded at CHIP8_START_ADDRESS and the rest of
+     * memory cleared. Bytes that don't fit in memory are left out, see RomFile.
+     */
+    CPU(const uint8_t* rom, size_t size);
+    ~CPU();
+
+    void emulate_cycle();
+
+    /*
+     * Executes 'cycles' instructions with the selected engine and returns how many ran.
+     * This stops early once FX0A starts waiting for a key and never touches the timers,
+     * see tickTimers(). Trips around a loop that polls the delay timer are skipped rather
+     * than executed, see idleCycles().
+     */
+    uint32_t run(uint32_t cycles);
+
+    /*
+     * Instructions run() skipped in idle loops rather than executing them, since the CPU was
+     * created or last restored with load(). These count as executed.
+     */
+    uint64_t idleCycles() const;
+
+    /* Like run() but for any number of instructions. Stops early once FX0A waits for a key. */
+    uint64_t runCycles(uint64_t cycles);
+
+    /*
+     * Runs one 60 Hz frame: 'instructionsPerFrame' instructions, or fewer if FX0A waits for a
+     * key, then one tick of the timers. Returns the instructions executed.
+     */
+    uint32_t runFrame(uint32_t instructionsPerFrame);
+
+    /*
+     * Executes up to 'cycles' instructions, stopping as soon as one of the CHIP8_STOP_* 'events'
+     * happens. With CHIP8_STOP_PC the run stops once the pc arrives at 'pc', before executing the
+     * instruction there; at least one instruction runs first, so calling this again moves on.
+     * The engines check for the events themselves, so this costs no more than run().
+     */
+    RunResult runUntil(uint32_t events, uint64_t cycles, uint16_t pc = 0);
+
+    /* Counts the delay and sound timers down by one. This is meant to be called at 60 Hz. */
+    void tickTimers();
+
+    void setEngine(Engine engine);
+    static bool hasEngine(Engine engine);
+
+    /*
+     * Attaches a program translated ahead of time for use by Engine::Aot.
+     * Returns false if it wasn't translated from the ROM this CPU is running.
+     */
+    bool loadProgram(const AotProgram& program);
+
+    uint16_t next();
+    void decode(uint16_t op);
+
+    /* Restarts the random numbers CXNN produces from 'seed'. The seed is part of save states. */
+    void setSeed(uint64_t seed);
+
+    /*
+     * Sets the keys that are held, as a bitmask where bit N is set while key N is held.
+     * A key that goes down while FX0A is waiting completes it.
+     */
+    void setKeys(uint16_t keys);
+
+    /* Whether FX0A is waiting for a key press. Until then run() executes nothing. */
+    bool isWaitingForKey() const;
+
+    /* Beeps go to 'host'. Without one they're dropped. */
+    void setHost(Host* host);
+
+    /* Where beeps go, a host that drops them if none was set */
+    Host* getHost() const;
+
+    void dump();
+
+#ifdef CHIP8EMU_PROFILE
+    /* What the switch and threaded engines executed since the CPU was created or the last reset */
+    const Profile& getProfile() const;
+    void resetProfile();
+#endif
+
+    /* Whether anything was drawn since setDraw(false) */
+    bool needsDraw() const;
+
+    /* The rows drawn since setDraw(false) as a mask with bit N set for row N */
+    uint32_t getDirtyRows() const;
+
+    /* false once the screen has been shown, true to have every row shown again */
+    void setDraw(bool draw);
+
+    /* The screen as one word per row, see framebuffer.h */
+    const uint64_t* getGFX() const;
+
+    /* Bytes needed to hold a snapshot */
+    static size_t snapshotSize();
+
+    /* Writes a snapshot of the machine to 'buffer'. Returns false if 'size' is too small. */
+    bool save(uint8_t* buffer, size_t size) const;
+
+    /*
+     * Restores a snapshot written by save(). Returns false, leaving the machine untouched, if the
+     * snapshot is from another version or is damaged. The engine and host are kept as they are.
+     */
+    bool load(const uint8_t* buffer, size_t size);
+
+private:
+    Host* host;
+
+    /* Set by an instruction that needs the engine to stop: FX0A waiting, FX07 in an idle loop or a runUntil() event */
+    bool suspended;
+
+    /* Instructions in one trip around the idle loop FX07 found, see findIdleLoop() */
+    uint32_t idleLoopLength;
+    uint64_t skippedCycles;
+
+    /* What runUntil() is waiting for, and the event that happened. stopPc is NO_STOP_PC unless armed. */
+    uint32_t stopEvents;
+    uint32_t stopEvent;
+    uint16_t stopPc;
+    static const uint16_t NO_STOP_PC = 0xFFFF;
+
+    Engine engine;
+    std::unique_ptr<Jit> jit; /* Only created once the JIT engine is selected */
+    std::unique_ptr<AotRuntime> aot; /* Only created once a program is loaded */
+
+#ifdef CHIP8EMU_PROFILE
+    Profile profile;
+#endif
+
+    /*
+     * Predecoded instructions for every address in memory.
+     * ROMs are free to jump to odd addresses so every byte gets a slot.
+     * Slots start out as Op::DECODE and are filled in the first time they're fetched.
+     */
+    Instruction icache[CHIP8_MEMORY_SIZE];
+
+    const Instruction& fetch();
+    void execute(const Instruction& ins);
+    void invalidate(uint16_t address, uint16_t length);
+
+    uint32_t dispatch(uint32_t cycles);
+    uint32_t findIdleLoop() const;
+    void checkIdleLoop();
+
+    uint32_t runSwitch(uint32_t cycles);
+    uint32_t runThreaded(uint32_t cycles);
+
+    friend class Jit;
+    friend class AotRuntime;
+
+#define CHIP8_OP_HANDLER(name) void exec##name(const Instruction& ins);
+    CHIP8_INSTRUCTIONS(CHIP8_OP_HANDLER)
+#undef CHIP8_OP_HANDLER
 };
\ No newline at end of file
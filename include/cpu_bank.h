@@ -0,0 +1,360 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "common.h"
+#include "framebuffer.h"
+#include "instruction.h"
+#include "rng.h"
+
+/*
+ * Kernels that apply one instruction to every lane of a CPUBank at once.
+ * Each works on 'n' consecutive lanes and uses AVX2 when the build enables it (CHIP8EMU_AVX2).
+ * Flag updates happen in the same order as in the matching CPU::exec* handler so that
+ * instructions which name VF as an operand behave the same way, and the kernels that move the pc
+ * wrap it around the end of memory like the CPU does.
+ */
+bool bank_all_equal8(const uint8_t* values, size_t n);
+bool bank_all_equal16(const uint16_t* values, size_t n);
+void bank_fill16(uint16_t* values, uint16_t value, size_t n);
+void bank_advance(uint16_t* pc, size_t n);
+void bank_tick(uint8_t* timers, size_t n);
+
+void bank_add_imm(uint8_t* x, uint8_t imm, size_t n);
+void bank_copy(uint8_t* x, const uint8_t* y, size_t n);
+void bank_or(uint8_t* x, const uint8_t* y, size_t n);
+void bank_and(uint8_t* x, const uint8_t* y, size_t n);
+void bank_xor(uint8_t* x, const uint8_t* y, size_t n);
+void bank_add_carry(uint8_t* x, const uint8_t* y, uint8_t* vf, size_t n);
+void bank_sub_borrow(uint8_t* x, const uint8_t* y, uint8_t* vf, size_t n);
+void bank_rsub_borrow(uint8_t* x, const uint8_t* y, uint8_t* vf, size_t n);
+void bank_shr(uint8_t* x, uint8_t* vf, size_t n);
+void bank_shl(uint8_t* x, uint8_t* vf, size_t n);
+void bank_add_index(uint16_t* index, const uint8_t* x, size_t n);
+
+/* pc += 4 where (x == imm) == ifEqual, pc += 2 everywhere else */
+void bank_skip_imm(uint16_t* pc, const uint8_t* x, uint8_t imm, bool ifEqual, size_t n);
+
+/* pc += 4 where (x == y) == ifEqual, pc += 2 everywhere else */
+void bank_skip_reg(uint16_t* pc, const uint8_t* x, const uint8_t* y, bool ifEqual, size_t n);
+
+/*
+ * N instances of the same ROM, stored as structure-of-arrays so that register N of every
+ * instance sits in one contiguous row.
+ *
+ * Every step executes one instruction on every lane. While all lanes are at the same pc and
+ * see the same opcode there, the instruction is decoded once and register, index, timer and
+ * branch instructions run through the vector kernels above; everything else (drawing, memory,
+ * keys, the stack, random numbers) loops over the lanes. Once the lanes diverge each one is
+ * stepped on its own until their pcs line up again.
+ *
+ * Lanes only differ through their keys and random number seeds. The bank is large (N * ~6KB) so it
+ * is meant to be allocated on the heap.
+ */
+template <size_t N>
+class CPUBank {
+public:
+    /*
+     * Every lane starts with the 'size' bytes at 'rom' loaded at CHIP8_START_ADDRESS and the rest of
+     * memory cleared, like CPU. Bytes that don't fit in memory are left out.
+     */
+    CPUBank(const uint8_t* rom, size_t size);
+
+    /* Executes 'steps' instructions on every lane. This never touches the timers. */
+    void run(uint64_t steps);
+
+    /* Counts every lane's delay and sound timers down by one. This is meant to be called at 60 Hz. */
+    void tickTimers();
+
+    /* The keys held on 'lane', see CPU::setKeys(). A lane waiting in FX0A re-executes it until a key goes down. */
+    void setKeys(size_t lane, uint16_t keys);
+
+    /* Restarts the random numbers CXNN produces on 'lane' from 'seed' */
+    void setSeed(size_t lane, uint64_t seed);
+
+    uint16_t getPC(size_t lane) const { return pc[lane]; }
+    uint16_t getSP(size_t lane) const { return sp[lane]; }
+    uint8_t getV(size_t lane, uint8_t reg) const { return V[reg][lane]; }
+    const uint64_t* getGFX(size_t lane) const { return gfx[lane]; }
+
+    bool needsDraw(size_t lane) const { return need_draw[lane]; }
+    void setDraw(size_t lane, bool draw) { need_draw[lane] = draw; }
+
+    /* How many steps ran in lockstep and how many had to step each lane on its own */
+    uint64_t lockstepSteps() const { return lockstep; }
+    uint64_t divergentSteps() const { return divergent; }
+
+private:
+    uint8_t memory[CHIP8_MEMORY_SIZE][N];
+    uint8_t V[CHIP8_REGISTER_COUNT][N];
+    uint16_t stack[CHIP8_STACK_DEPTH][N];
+    uint16_t sp[N];
+    uint16_t index[N];
+    uint16_t pc[N];
+    uint8_t delay_timer[N];
+    uint8_t sound_timer[N];
+    uint16_t keys[N];
+    bool waiting_for_key[N];
+    uint64_t rng[N];
+    bool need_draw[N];
+    uint64_t gfx[N][CHIP8_PIXELS_HEIGHT];
+
+    /* Instructions decoded in lockstep, tagged with the opcode they were decoded from */
+    Instruction icache[CHIP8_MEMORY_SIZE];
+    uint16_t icacheOpcode[CHIP8_MEMORY_SIZE];
+
+    /* Set once any lane writes memory, after which lanes may hold different code */
+    bool memoryWritten;
+
+    uint64_t lockstep;
+    uint64_t divergent;
+
+    uint16_t opcodeAt(size_t lane, uint16_t address) const
+    {
+        return memory[address & CHIP8_ADDRESS_MASK][lane] << 8 | memory[(address + 1) & CHIP8_ADDRESS_MASK][lane];
+    }
+
+    void stepLockstep();
+    void executeLane(size_t lane, const Instruction& ins);
+};
+
+template <size_t N>
+CPUBank<N>::CPUBank(const uint8_t* rom, size_t size)
+    : memoryWritten(false), lockstep(0), divergent(0)
+{
+    if (size > CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS) {
+        size = CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS;
+    }
+    for (size_t a = 0; a < CHIP8_MEMORY_SIZE; ++a) {
+        uint8_t value = 0;
+        if (a < CHIP8_FONT_COUNT) {
+            value = CHIP8_FONTSET[a];
+        } else if (a >= CHIP8_START_ADDRESS && a - CHIP8_START_ADDRESS < size) {
+            value = rom[a - CHIP8_START_ADDRESS];
+        }
+        std::memset(memory[a], value, N);
+    }
+
+    std::memset(V, 0, sizeof(V));
+    std::memset(stack, 0, sizeof(stack));
+    std::memset(sp, 0, sizeof(sp));
+    std::memset(index, 0, sizeof(index));
+    bank_fill16(pc, CHIP8_START_ADDRESS, N);
+    std::memset(delay_timer, 0, sizeof(delay_timer));
+    std::memset(sound_timer, 0, sizeof(sound_timer));
+    std::memset(keys, 0, sizeof(keys));
+    std::memset(waiting_for_key, 0, sizeof(waiting_for_key));
+    for (size_t l = 0; l < N; ++l) {
+        rng[l] = rng_seed(CHIP8_DEFAULT_SEED);
+    }
+    std::memset(need_draw, 0, sizeof(need_draw));
+    std::memset(gfx, 0, sizeof(gfx));
+
+    for (size_t a = 0; a < CHIP8_MEMORY_SIZE; ++a) {
+        icache[a] = { Op::DECODE, 0, 0, 0, 0, 0 };
+        icacheOpcode[a] = 0;
+    }
+}
+
+template <size_t N>
+void CPUBank<N>::setKeys(size_t lane, uint16_t k)
+{
+    const uint16_t pressed = k & ~keys[lane];
+    keys[lane] = k;
+    if (waiting_for_key[lane] && pressed != 0) {
+        uint8_t key = 0;
+        while (!(pressed & (1 << key))) {
+            ++key;
+        }
+        V[memory[pc[lane]][lane] & 0xF][lane] = key;
+        pc[lane] = (pc[lane] + 2) & CHIP8_ADDRESS_MASK;
+        waiting_for_key[lane] = false;
+    }
+}
+
+template <size_t N>
+void CPUBank<N>::setSeed(size_t lane, uint64_t seed)
+{
+    rng[lane] = rng_seed(seed);
+}
+
+template <size_t N>
+void CPUBank<N>::run(uint64_t steps)
+{
+    for (uint64_t s = 0; s < steps; ++s) {
+        const uint16_t at = pc[0] & CHIP8_ADDRESS_MASK;
+        const bool together = bank_all_equal16(pc, N) &&
+            (!memoryWritten || (bank_all_equal8(memory[at], N) && bank_all_equal8(memory[(at + 1) & CHIP8_ADDRESS_MASK], N)));
+        if (together) {
+            stepLockstep();
+            ++lockstep;
+        } else {
+            for (size_t l = 0; l < N; ++l) {
+                executeLane(l, decode_instruction(opcodeAt(l, pc[l])));
+            }
+            ++divergent;
+        }
+    }
+}
+
+template <size_t N>
+void CPUBank<N>::tickTimers()
+{
+    bank_tick(delay_timer, N);
+    bank_tick(sound_timer, N);
+}
+
+template <size_t N>
+void CPUBank<N>::stepLockstep()
+{
+    const uint16_t at = pc[0] & CHIP8_ADDRESS_MASK;
+    const uint16_t opcode = opcodeAt(0, at);
+    if (icache[at].op == Op::DECODE || icacheOpcode[at] != opcode) {
+        icache[at] = decode_instruction(opcode);
+        icacheOpcode[at] = opcode;
+    }
+    const Instruction ins = icache[at];
+
+    uint8_t* vx = V[ins.X];
+    const uint8_t* vy = V[ins.Y];
+    uint8_t* vf = V[0xF];
+
+    switch (ins.op) {
+    case Op::JMP: bank_fill16(pc, ins.NNN, N); return;
+    case Op::SKE: bank_skip_imm(pc, vx, ins.NN, true, N); return;
+    case Op::SKNE: bank_skip_imm(pc, vx, ins.NN, false, N); return;
+    case Op::SKRE: bank_skip_reg(pc, vx, vy, true, N); return;
+    case Op::SKRNE: bank_skip_reg(pc, vx, vy, false, N); return;
+    case Op::LOAD: std::memset(vx, ins.NN, N); break;
+    case Op::ADD: bank_add_imm(vx, ins.NN, N); break;
+    case Op::ASN: bank_copy(vx, vy, N); break;
+    case Op::OR: bank_or(vx, vy, N); break;
+    case Op::AND: bank_and(vx, vy, N); break;
+    case Op::XOR: bank_xor(vx, vy, N); break;
+    case Op::RADD: bank_add_carry(vx, vy, vf, N); break;
+    case Op::SUB: bank_sub_borrow(vx, vy, vf, N); break;
+    case Op::RSUB: bank_rsub_borrow(vx, vy, vf, N); break;
+    case Op::SHR: bank_shr(vx, vf, N); break;
+    case Op::SHL: bank_shl(vx, vf, N); break;
+    case Op::ILOAD: bank_fill16(index, ins.NNN, N); break;
+    case Op::IADD: bank_add_index(index, vx, N); break;
+    case Op::DELA: bank_copy(vx, delay_timer, N); break;
+    case Op::DELR: bank_copy(delay_timer, vx, N); break;
+    case Op::SNDR: bank_copy(sound_timer, vx, N); break;
+    default:
+        /* Everything else depends on per-lane state that doesn't vectorize */
+        for (size_t l = 0; l < N; ++l) {
+            executeLane(l, ins);
+        }
+        return;
+    }
+    bank_advance(pc, N);
+}
+
+/* Mirrors the CPU::exec* handlers for a single lane */
+template <size_t N>
+void CPUBank<N>::executeLane(size_t l, const Instruction& ins)
+{
+    uint8_t& vx = V[ins.X][l];
+    const uint8_t vy = V[ins.Y][l];
+    uint8_t& vf = V[0xF][l];
+
+    switch (ins.op) {
+    case Op::CLR:
+        std::memset(gfx[l], 0, sizeof(gfx[l]));
+        need_draw[l] = true;
+        break;
+    case Op::RET:
+        sp[l] = (sp[l] - 1) & CHIP8_STACK_MASK;
+        pc[l] = stack[sp[l]][l];
+        return;
+    case Op::JMP:
+        pc[l] = ins.NNN;
+        return;
+    case Op::CALL:
+        stack[sp[l]][l] = (pc[l] + 2) & CHIP8_ADDRESS_MASK;
+        sp[l] = (sp[l] + 1) & CHIP8_STACK_MASK;
+        pc[l] = ins.NNN;
+        return;
+    case Op::SKE: pc[l] = (pc[l] + (vx == ins.NN ? 4 : 2)) & CHIP8_ADDRESS_MASK; return;
+    case Op::SKNE: pc[l] = (pc[l] + (vx != ins.NN ? 4 : 2)) & CHIP8_ADDRESS_MASK; return;
+    case Op::SKRE: pc[l] = (pc[l] + (vx == vy ? 4 : 2)) & CHIP8_ADDRESS_MASK; return;
+    case Op::SKRNE: pc[l] = (pc[l] + (vx != vy ? 4 : 2)) & CHIP8_ADDRESS_MASK; return;
+    case Op::LOAD: vx = ins.NN; break;
+    case Op::ADD: vx += ins.NN; break;
+    case Op::ASN: vx = vy; break;
+    case Op::OR: vx |= vy; break;
+    case Op::AND: vx &= vy; break;
+    case Op::XOR: vx ^= vy; break;
+    case Op::RADD:
+        vf = V[ins.Y][l] > 0xFF - V[ins.X][l] ? 1 : 0;
+        V[ins.X][l] += V[ins.Y][l];
+        break;
+    case Op::SUB:
+        vf = V[ins.Y][l] > 0xFF - V[ins.X][l] ? 0 : 1;
+        V[ins.X][l] -= V[ins.Y][l];
+        break;
+    case Op::RSUB:
+        vf = V[ins.Y][l] > 0xFF - V[ins.X][l] ? 0 : 1;
+        V[ins.X][l] = V[ins.Y][l] - V[ins.X][l];
+        break;
+    case Op::SHR:
+        vf = vx & 0x1;
+        vx >>= 1;
+        break;
+    case Op::SHL:
+        vf = 0;
+        vx <<= 1;
+        break;
+    case Op::ILOAD: index[l] = ins.NNN; break;
+    case Op::ZJMP:
+        pc[l] = (ins.NNN + V[0][l]) & CHIP8_ADDRESS_MASK;
+        return;
+    case Op::RAND: vx = ins.NN & rng_next_byte(rng[l]); break;
+    case Op::DRAW: {
+        const uint8_t col = vx % CHIP8_PIXELS_WIDTH;
+        const uint8_t row = vy % CHIP8_PIXELS_HEIGHT;
+        bool collision = false;
+        for (uint8_t h = 0; h < ins.N && row + h < CHIP8_PIXELS_HEIGHT; ++h) {
+            collision |= framebuffer_xor_row(gfx[l], memory[(index[l] + h) & CHIP8_ADDRESS_MASK][l], col, row + h);
+        }
+        vf = collision ? 1 : 0;
+        need_draw[l] = true;
+        break;
+    }
+    case Op::SKK: pc[l] = (pc[l] + ((keys[l] >> (vx & 0xF)) & 1 ? 4 : 2)) & CHIP8_ADDRESS_MASK; return;
+    case Op::SKNK: pc[l] = (pc[l] + ((keys[l] >> (vx & 0xF)) & 1 ? 2 : 4)) & CHIP8_ADDRESS_MASK; return;
+    case Op::DELA: vx = delay_timer[l]; break;
+    case Op::KEYW:
+        /* Like the CPU this stays put until setKeys() sees a key go down */
+        waiting_for_key[l] = true;
+        return;
+    case Op::DELR: delay_timer[l] = vx; break;
+    case Op::SNDR: sound_timer[l] = vx; break;
+    case Op::IADD: index[l] += vx; break;
+    case Op::SILS: index[l] = vx * 5; break;
+    case Op::BCD:
+        memory[index[l] & CHIP8_ADDRESS_MASK][l] = vx / 100;
+        memory[(index[l] + 1) & CHIP8_ADDRESS_MASK][l] = (vx / 10) % 10;
+        memory[(index[l] + 2) & CHIP8_ADDRESS_MASK][l] = vx % 10;
+        memoryWritten = true;
+        break;
+    case Op::DUMP:
+        for (int i = 0; i <= ins.X; ++i) {
+            memory[(index[l] + i) & CHIP8_ADDRESS_MASK][l] = V[i][l];
+        }
+        memoryWritten = true;
+        break;
+    case Op::IDUMP:
+        for (int i = 0; i <= ins.X; ++i) {
+            V[i][l] = memory[(index[l] + i) & CHIP8_ADDRESS_MASK][l];
+        }
+        break;
+    case Op::INVALID:
+    default:
+        /* Like the CPU, an invalid opcode leaves the lane stuck where it is */
+        return;
+    }
+    pc[l] = (pc[l] + 2) & CHIP8_ADDRESS_MASK;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "common.h"
+#include "host.h"
+
+/*
+ * Hands values from one producer thread to one consumer thread without locks or waiting.
+ *
+ * There are three slots: the producer fills its own, the consumer reads its own and the third
+ * holds the newest published value. Publishing and taking swap a private slot with the shared
+ * one, so the producer never waits for the consumer and the consumer always gets the newest
+ * value; anything it was too slow to see is skipped.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : slots(), writeIndex(0), shared(1), readIndex(2) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /* Producer: the slot to fill before calling publish() */
+    T& back() { return slots[writeIndex]; }
+
+    /*
+     * Producer: makes back() the newest value and hands out a new slot to fill. Returns true if
+     * that slot holds a value the consumer never took, which is then still there to look at.
+     */
+    bool publish()
+    {
+        const uint8_t previous = shared.exchange(writeIndex | FRESH, std::memory_order_acq_rel);
+        writeIndex = previous & INDEX;
+        return (previous & FRESH) != 0;
+    }
+
+    /* Consumer: moves the newest value into front(). Returns false if nothing new was published. */
+    bool update()
+    {
+        if (!(shared.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    /* Consumer: the value update() took last */
+    const T& front() const { return slots[readIndex]; }
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4; /* Set while the shared slot holds a value the consumer hasn't taken */
+
+    T slots[3];
+    uint8_t writeIndex;
+    std::atomic<uint8_t> shared;
+    uint8_t readIndex;
+};
+
+/*
+ * A host for a CPU running on its own thread. Frames and beeps are queued up for another
+ * thread, typically the one that owns the window, to pick up with take() and takeBeeps().
+ * The dirty rows of frames that are dropped because the other thread didn't keep up are
+ * carried over to the next frame.
+ */
+class FrameQueue : public Host {
+public:
+    FrameQueue() : beeps(0), droppedRows(0) {}
+
+    /* Emulation thread */
+    void beep() override { beeps.fetch_add(1, std::memory_order_relaxed); }
+
+    void present(const uint64_t* gfx, uint32_t dirtyRows) override
+    {
+        Frame& frame = frames.back();
+        std::memcpy(frame.rows, gfx, sizeof(frame.rows));
+        frame.dirtyRows = dirtyRows | droppedRows;
+        droppedRows = frames.publish() ? frames.back().dirtyRows : 0;
+    }
+
+    /*
+     * Presentation thread: copies the newest frame into 'gfx' and the rows that changed since the
+     * previous one taken into 'dirtyRows'. Returns false if there's no new frame.
+     */
+    bool take(uint64_t* gfx, uint32_t& dirtyRows)
+    {
+        if (!frames.update()) {
+            return false;
+        }
+        std::memcpy(gfx, frames.front().rows, sizeof(Frame::rows));
+        dirtyRows = frames.front().dirtyRows;
+        return true;
+    }
+
+    /* Presentation thread: the number of beeps since the last call */
+    uint32_t takeBeeps() { return beeps.exchange(0, std::memory_order_relaxed); }
+
+private:
+    struct Frame {
+        uint64_t rows[CHIP8_PIXELS_HEIGHT];
+        uint32_t dirtyRows;
+    };
+
+    TripleBuffer<Frame> frames;
+    std::atomic<uint32_t> beeps;
+    uint32_t droppedRows; /* Emulation thread: rows of the frames the other thread never took */
+};
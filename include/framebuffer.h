@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include "common.h"
+
+/*
+ * The screen is stored as one 64-bit word per row. Pixel x of a row is bit (63 - x), so the
+ * leftmost pixel is the most significant bit just like in a sprite byte and a sprite row can be
+ * drawn with a single shift and XOR.
+ */
+static_assert(CHIP8_PIXELS_WIDTH == 64, "A framebuffer row must fit in one 64-bit word");
+
+/*
+ * Changes to the screen are tracked as a mask with bit N set when row N changed, so that
+ * renderers only have to upload those rows.
+ */
+static_assert(CHIP8_PIXELS_HEIGHT == 32, "A dirty row mask must fit in 32 bits");
+#define CHIP8_ALL_ROWS (0xFFFFFFFFu)
+
+/* The dirty row mask for 'count' rows starting at row 'y' (< 32), clipped at the bottom edge */
+inline uint32_t framebuffer_row_mask(unsigned y, unsigned count)
+{
+    const unsigned end = y + count < CHIP8_PIXELS_HEIGHT ? y + count : CHIP8_PIXELS_HEIGHT;
+    return static_cast<uint32_t>((uint64_t(1) << end) - (uint64_t(1) << y));
+}
+
+/* Whether pixel (x, y) is lit */
+inline bool framebuffer_pixel(const uint64_t* rows, unsigned x, unsigned y)
+{
+    return (rows[y] >> (CHIP8_PIXELS_WIDTH - 1 - x)) & 1;
+}
+
+/*
+ * XORs the 8 pixels of 'sprite' into row 'y' starting at column 'x' (< 64). Pixels past the right
+ * edge are clipped. Returns whether a lit pixel was switched off.
+ */
+inline bool framebuffer_xor_row(uint64_t* rows, uint8_t sprite, unsigned x, unsigned y)
+{
+    const uint64_t bits = x <= CHIP8_PIXELS_WIDTH - 8
+        ? static_cast<uint64_t>(sprite) << (CHIP8_PIXELS_WIDTH - 8 - x)
+        : static_cast<uint64_t>(sprite) >> (x - (CHIP8_PIXELS_WIDTH - 8));
+    const bool collision = (rows[y] & bits) != 0;
+    rows[y] ^= bits;
+    return collision;
+}
+
+/* Expands the framebuffer into one byte (0 or 1) per pixel for renderers that want that */
+inline void framebuffer_unpack(const uint64_t* rows, uint8_t* pixels)
+{
+    for (unsigned y = 0; y < CHIP8_PIXELS_HEIGHT; ++y) {
+        for (unsigned x = 0; x < CHIP8_PIXELS_WIDTH; ++x) {
+            pixels[y * CHIP8_PIXELS_WIDTH + x] = framebuffer_pixel(rows, x, y);
+        }
+    }
+}
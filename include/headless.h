@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include "host.h"
+#include "scheduler.h"
+
+class CPU;
+
+/* A host with no display and no speaker that just counts what happens */
+class HeadlessHost : public Host {
+public:
+    HeadlessHost() : frames(0), beeps(0) {}
+
+    void beep() override { ++beeps; }
+    void present(const uint64_t*, uint32_t) override { ++frames; }
+
+    uint64_t frames;
+    uint64_t beeps;
+};
+
+struct HeadlessResult {
+    uint64_t cycles;          /* Instructions executed */
+    uint64_t idleCycles;      /* Of those, how many were skipped in idle loops, see CPU::idleCycles() */
+    uint64_t frames;          /* Frames presented to the host */
+    uint64_t framebufferHash; /* Hash of the final frame, see hash_framebuffer() */
+};
+
+/*
+ * Runs 'cpu' for 'cycles' instructions as fast as possible, in 60 Hz frames of
+ * 'instructionsPerFrame' instructions. Every frame that drew something is presented to 'host'.
+ * The run ends early if the ROM waits for a key with FX0A.
+ */
+HeadlessResult run_headless(CPU& cpu, Host& host, uint64_t cycles,
+                            uint32_t instructionsPerFrame = CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+
+/* 64-bit FNV-1a hash of a frame, handy for comparing runs */
+uint64_t hash_framebuffer(const uint64_t* gfx);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Everything the emulator sends to the outside world.
+ * The core never talks to a window or speaker directly so that it can run without
+ * either, e.g. on a server with no display. Keys are fed to it with CPU::setKeys().
+ */
+class Host {
+public:
+    virtual ~Host() = default;
+
+    /* Called when the sound timer runs out */
+    virtual void beep() = 0;
+
+    /*
+     * Shows a finished frame of CHIP8_PIXELS_HEIGHT rows, see framebuffer.h for the layout.
+     * Only the rows set in 'dirtyRows' changed since the previous frame.
+     */
+    virtual void present(const uint64_t* gfx, uint32_t dirtyRows) = 0;
+};
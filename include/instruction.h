@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Every instruction the CPU understands along with its mnemonic.
+ * The order here defines the numbering of the Op enumeration below.
+ */
+#define CHIP8_INSTRUCTIONS(X) \
+    X(CLR)   /* 00E0 */ \
+    X(RET)   /* 00EE */ \
+    X(JMP)   /* 1NNN */ \
+    X(CALL)  /* 2NNN */ \
+    X(SKE)   /* 3XNN */ \
+    X(SKNE)  /* 4XNN */ \
+    X(SKRE)  /* 5XY0 */ \
+    X(LOAD)  /* 6XNN */ \
+    X(ADD)   /* 7XNN */ \
+    X(ASN)   /* 8XY0 */ \
+    X(OR)    /* 8XY1 */ \
+    X(AND)   /* 8XY2 */ \
+    X(XOR)   /* 8XY3 */ \
+    X(RADD)  /* 8XY4 */ \
+    X(SUB)   /* 8XY5 */ \
+    X(SHR)   /* 8XY6 */ \
+    X(RSUB)  /* 8XY7 */ \
+    X(SHL)   /* 8XYE */ \
+    X(SKRNE) /* 9XY0 */ \
+    X(ILOAD) /* ANNN */ \
+    X(ZJMP)  /* BNNN */ \
+    X(RAND)  /* CXNN */ \
+    X(DRAW)  /* DXYN */ \
+    X(SKK)   /* EX9E */ \
+    X(SKNK)  /* EXA1 */ \
+    X(DELA)  /* FX07 */ \
+    X(KEYW)  /* FX0A */ \
+    X(DELR)  /* FX15 */ \
+    X(SNDR)  /* FX18 */ \
+    X(IADD)  /* FX1E */ \
+    X(SILS)  /* FX29 */ \
+    X(BCD)   /* FX33 */ \
+    X(DUMP)  /* FX55 */ \
+    X(IDUMP) /* FX65 */ \
+    X(INVALID) /* Anything we don't recognize */
+
+enum class Op : uint8_t {
+#define CHIP8_OP_ENUM(name) name,
+    CHIP8_INSTRUCTIONS(CHIP8_OP_ENUM)
+#undef CHIP8_OP_ENUM
+    DECODE, /* Placeholder for a cache slot that hasn't been decoded yet */
+    COUNT
+};
+
+/*
+ * A decoded instruction with all of its operands already extracted.
+ * This is kept at 8 bytes so that a cache covering all of memory stays small.
+ */
+struct alignas(8) Instruction {
+    Op op;
+    uint8_t X;
+    uint8_t Y;
+    uint8_t N;
+    uint8_t NN;
+    uint16_t NNN;
+};
+
+Instruction decode_instruction(uint16_t opcode);
+
+/* The mnemonic of 'op', e.g. "DRAW" */
+const char* op_name(Op op);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "common.h"
+
+class CPU;
+
+/*
+ * Dynamic recompiler that translates runs of instructions into x86-64 code.
+ *
+ * A block starts at some pc and covers every instruction up to the next branch or skip. Everything
+ * but drawing is translated natively, 00E0 and DXYN call the CPU's own handlers from the translated
+ * code. Only FX0A and invalid opcodes are left to the interpreter. A store to memory that lands on
+ * translated code drops every block and leaves the block it was made from.
+ *
+ * Blocks jump straight into each other: a branch to a known address is linked to the block there
+ * once it exists, and RET and BNNN look the next block up in a table. Control only comes back to
+ * run() once the cycles it was given are used up, the CPU is suspended, translated code was
+ * overwritten or no block exists at the pc yet. Every instruction counts down the cycles, so a
+ * block stops exactly where the interpreter would. Blocks never look at runUntil()'s address;
+ * while one is armed, run() enters them for one instruction at a time and checks the pc itself.
+ *
+ * This is only available on x86-64 POSIX systems; everywhere else available() is false.
+ *
+ * The code cache is never writable and executable at once: translations are written while it
+ * is read/write and it is switched to read/execute before any of them runs.
+ */
+class Jit {
+public:
+    Jit();
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static bool available();
+
+    /* Whether the code cache is mapped. Without one the CPU falls back to the switch engine. */
+    bool usable() const;
+
+    /* Executes up to 'cycles' instructions on 'cpu' and returns how many ran */
+    uint32_t run(CPU& cpu, uint32_t cycles);
+
+    /* Drops the blocks that were translated from [address, address + length) */
+    void invalidate(uint16_t address, uint16_t length);
+
+private:
+    struct Block {
+        const uint8_t* code; /* nullptr when the instruction at this address can't be translated */
+        uint16_t end;        /* One past the last byte this block was translated from */
+        bool compiled;       /* Whether we've looked at this address yet */
+    };
+
+    /* A jump to 'target' that goes through the block table until there's a block to link it to */
+    struct Link {
+        uint16_t target;
+        size_t at; /* Where the jump is in the cache */
+    };
+
+    /* Read by the translated code, which expects 'code' to come first in 16 byte entries */
+    Block blocks[CHIP8_MEMORY_SIZE];
+    std::vector<Link> links;
+
+    /* Nonzero for every byte some block was translated from, so writes elsewhere skip the block scan */
+    uint8_t translated[CHIP8_MEMORY_SIZE];
+    uint32_t drops; /* How often every block was dropped, which translated code checks after a memory write */
+
+    uint8_t* cache;       /* Memory holding the translated code */
+    size_t cacheUsed;
+    bool cacheWritable;   /* Whether the cache is currently read/write rather than read/execute */
+
+    const uint8_t* lookup(CPU& cpu);
+    void compile(CPU& cpu, uint16_t start);
+    void drop();
+    void flush();
+
+    bool makeWritable();
+    bool makeExecutable();
+    void release();
+
+    /* Executes the instruction packed into 'packed' for translated code, returns whether the CPU was suspended */
+    static uint32_t interpret(CPU* cpu, uint64_t packed);
+
+    /* Invalidates what translated code just stored at [index, index + length), returns whether blocks were dropped */
+    static uint32_t written(CPU* cpu, uint64_t length);
+
+    /* Looks for an idle loop after translated code read the delay timer, returns whether the CPU was suspended */
+    static uint32_t checkIdleLoop(CPU* cpu);
+};
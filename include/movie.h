@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "headless.h"
+#include "rng.h"
+#include "scheduler.h"
+
+class CPU;
+class Host;
+
+/* A stretch of consecutive frames with the same keys held */
+struct MovieRun {
+    uint32_t frames;
+    uint16_t keys; /* Bit N is set while key N is held */
+};
+
+/*
+ * A recording of the keypad, one mask per 60 Hz frame, along with the random number seed and
+ * instructions per frame it was recorded with. Playing it back from the ROM's initial state
+ * reproduces the recorded run exactly.
+ *
+ * Keys are usually held for many frames at a time so frames are stored as runs of the same mask.
+ */
+struct Movie {
+    uint64_t seed = CHIP8_DEFAULT_SEED;
+    uint32_t instructionsPerFrame = CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME;
+    std::vector<MovieRun> runs;
+};
+
+/* Appends a frame during which 'keys' were held */
+void movie_record(Movie& movie, uint16_t keys);
+
+/* Number of frames in 'movie' */
+uint64_t movie_frames(const Movie& movie);
+
+/* Writes 'movie' to the file at 'path'. The format is little endian so movies can be shared between machines. */
+bool save_movie_file(const Movie& movie, const char* path);
+
+/*
+ * Reads a movie written by save_movie_file(). Returns false, leaving 'movie' untouched, if the
+ * file is damaged or truncated.
+ */
+bool load_movie_file(Movie& movie, const char* path);
+
+/*
+ * Plays 'movie' back on 'cpu' as fast as possible. Every frame runs with the recorded keys held,
+ * see CPU::setKeys(), and presents to 'host' if it drew something. Beeps also go to 'host', the
+ * CPU's own host is put back afterwards. 'cpu' is reseeded with the movie's seed, otherwise it
+ * should be freshly created from the ROM the movie was recorded on.
+ */
+HeadlessResult play_movie(CPU& cpu, Host& host, const Movie& movie);
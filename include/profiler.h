@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include "common.h"
+#include "instruction.h"
+
+/*
+ * Counts what the interpreter spends its time on: how often each kind of instruction runs,
+ * the host time it takes and how often each address is executed.
+ *
+ * This only exists in builds configured with -DCHIP8EMU_PROFILE=ON. Otherwise the
+ * CHIP8_PROFILE_* hooks below are empty and the CPU carries no profile at all. Only the switch
+ * and threaded engines are profiled; JIT and AOT blocks and skipped idle loops aren't counted.
+ */
+struct Profile {
+    uint64_t opCount[static_cast<size_t>(Op::COUNT)];
+    uint64_t opNanoseconds[static_cast<size_t>(Op::COUNT)]; /* Includes reading the clock twice */
+    uint64_t pcCount[CHIP8_MEMORY_SIZE];
+    Op pcOp[CHIP8_MEMORY_SIZE]; /* The instruction last executed at each address */
+
+    void record(Op op, uint16_t pc, uint64_t nanoseconds)
+    {
+        const size_t o = static_cast<size_t>(op);
+        ++opCount[o];
+        opNanoseconds[o] += nanoseconds;
+        ++pcCount[pc & (CHIP8_MEMORY_SIZE - 1)];
+        pcOp[pc & (CHIP8_MEMORY_SIZE - 1)] = op;
+    }
+};
+
+inline uint64_t profile_now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/* Addresses shown by print_profile() unless asked otherwise */
+#define CHIP8_PROFILE_HOTSPOTS (20)
+
+/*
+ * Writes the instructions sorted by time spent and the 'hotspots' most executed addresses to
+ * 'out'. Instructions that never ran are left out.
+ */
+void print_profile(const Profile& profile, std::FILE* out, size_t hotspots = CHIP8_PROFILE_HOTSPOTS);
+
+#ifdef CHIP8EMU_PROFILE
+    /* Wrapped around executing one instruction 'op' at 'pc', in a scope of its own */
+    #define CHIP8_PROFILE_BEGIN(pc, op) \
+        const uint16_t profiledPc = (pc); \
+        const Op profiledOp = (op); \
+        const uint64_t profiledStart = profile_now()
+    #define CHIP8_PROFILE_END(profile) (profile).record(profiledOp, profiledPc, profile_now() - profiledStart)
+#else
+    #define CHIP8_PROFILE_BEGIN(pc, op) do {} while (0)
+    #define CHIP8_PROFILE_END(profile) do {} while (0)
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CPU;
+
+/*
+ * Rewind history kept in a fixed amount of memory.
+ *
+ * A snapshot is taken every 'interval' frames. Only the newest one is kept whole; every older
+ * one is stored as the XOR of it and its successor, run length encoded, in a byte ring buffer.
+ * Consecutive frames rarely differ by more than a few sprites, so most deltas are a handful of
+ * bytes. Once the ring is full the oldest deltas are dropped.
+ *
+ * Each delta in the ring is framed by its length on both ends so that it can be dropped from
+ * the front and popped from the back without any bookkeeping outside the ring.
+ */
+class Rewind {
+public:
+    Rewind(size_t capacity, uint32_t interval);
+
+    /* Call once per emulated frame, this takes a snapshot every 'interval' frames */
+    void onFrame(const CPU& cpu);
+
+    /*
+     * Goes back one snapshot: to the newest one if frames ran since it was taken, otherwise to
+     * the one before it. Returns false, leaving the history as it was, once there's nothing
+     * older or if the snapshot couldn't be restored.
+     */
+    bool stepBack(CPU& cpu);
+
+    /* Number of snapshots that stepBack() can still go back to */
+    size_t depth() const;
+
+    /* Bytes of the ring holding deltas */
+    size_t bytesUsed() const;
+
+private:
+    std::vector<uint8_t> ring;
+    size_t head;  /* One past the end of the newest delta */
+    size_t tail;  /* Start of the oldest delta */
+    size_t used;
+    size_t count;
+
+    uint32_t interval;
+    uint32_t framesSinceSnapshot;
+
+    bool hasLatest;
+    bool atLatest;                /* Whether the CPU is still in the state 'latest' holds */
+    std::vector<uint8_t> latest;  /* The newest snapshot in full */
+    std::vector<uint8_t> current; /* Scratch space for the snapshot being taken */
+    std::vector<uint8_t> delta;   /* Scratch space for an encoded delta */
+
+    void push(const uint8_t* data, uint32_t length);
+    void dropOldest();
+    void write(size_t position, const uint8_t* data, size_t length);
+    void read(size_t position, uint8_t* data, size_t length) const;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * A small, fast xorshift64* generator for CXNN. Each CPU keeps its own state so instances are
+ * reproducible from their seed and never contend on a shared generator.
+ */
+
+/* Turns any seed, including 0, into a valid (non-zero) generator state using splitmix64 */
+inline uint64_t rng_seed(uint64_t seed)
+{
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+/* Advances 'state' and returns the next random byte */
+inline uint8_t rng_next_byte(uint64_t& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    /* The high bits of the multiplied output are the strongest */
+    return static_cast<uint8_t>((state * 0x2545F4914F6CDD1DULL) >> 56);
+}
+
+/* Seed used until one is set explicitly */
+#define CHIP8_DEFAULT_SEED (0)
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+/* Largest ROM that fits in memory after the interpreter area */
+#define CHIP8_MAX_ROM_SIZE (CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS)
+
+/* Why a ROM file couldn't be loaded */
+enum class RomError {
+    None,
+    Open,     /* The file doesn't exist or can't be opened */
+    NotAFile, /* The path is a directory, pipe or device */
+    Empty,    /* The file holds no instructions */
+    TooLarge, /* The file doesn't fit in memory after the interpreter area */
+    Read      /* Reading the file failed or it changed size while being read */
+};
+
+/* A description of 'error' for showing to the user */
+const char* rom_error_message(RomError error);
+
+/*
+ * A ROM file read in a single system call into a buffer of its own, for copying straight into a
+ * CPU. Only the bytes the file holds are read and copied, nothing is allocated on the heap.
+ */
+class RomFile {
+public:
+    RomFile();
+
+    /* Reads the ROM at 'filePath', checking that it fits in memory. The RomFile is empty on failure. */
+    RomError open(const char* filePath);
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t bytes[CHIP8_MAX_ROM_SIZE];
+    size_t length;
+};
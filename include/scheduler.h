@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "host.h"
+
+class CPU;
+
+/* How often the delay and sound timers count down, and how often frames are shown */
+#define CHIP8_FRAME_RATE (60)
+
+/* Instructions per 60 Hz frame unless told otherwise, roughly 700 instructions a second */
+#define CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME (12)
+
+/*
+ * Drives a CPU one 60 Hz frame at a time. Each frame executes a fixed budget of instructions,
+ * ticks the timers once and presents the screen if anything was drawn, so the game runs at
+ * the same speed no matter how fast the host is or how often it draws.
+ *
+ * In real time mode waitForNextFrame() paces frames against a steady clock. In turbo mode it
+ * returns straight away and the emulator runs as fast as it can, only presenting as many
+ * frames as a 60 Hz display would show. While the CPU waits for a key frames are always paced,
+ * so the host sleeps instead of spinning.
+ */
+class Scheduler {
+public:
+    Scheduler(CPU& cpu, Host& host, uint32_t instructionsPerFrame);
+
+    /* Runs one frame and returns how many instructions it executed */
+    uint32_t runFrame();
+
+    /* Sleeps until the next frame is due, unless in turbo mode */
+    void waitForNextFrame();
+
+    void setTurbo(bool turbo);
+    bool isTurbo() const;
+
+    uint64_t frames() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using FrameDuration = std::chrono::duration<int64_t, std::ratio<1, CHIP8_FRAME_RATE>>;
+
+    CPU& cpu;
+    Host& host;
+    uint32_t instructionsPerFrame;
+    bool turbo;
+    uint64_t frameCount;
+
+    /* Frames are due at 'epoch' plus a whole number of frame durations so rounding never drifts */
+    Clock::time_point epoch;
+    int64_t pacedFrames;
+
+    Clock::time_point lastPresent;
+};
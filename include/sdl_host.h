@@ -0,0 +1,39 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include "host.h"
+
+/*
+ * Shows the emulator in an SDL window and tracks the keypad from keyboard events.
+ * Frames are uploaded at their native 64x32 resolution to a streaming texture and the
+ * renderer scales them up to the window. Only the rows that changed are uploaded, and present()
+ * waits for vsync when the renderer supports it.
+ */
+class SdlHost : public Host {
+public:
+    /* SDL's video subsystem must be initialized before this is created */
+    explicit SdlHost(int scale);
+    ~SdlHost();
+
+    SdlHost(const SdlHost&) = delete;
+    SdlHost& operator=(const SdlHost&) = delete;
+
+    /* Whether the window could be created; SDL_GetError() has the details if not */
+    bool isOpen() const;
+
+    /* Updates the keypad from a keyboard or focus event. Returns false for events it doesn't handle. */
+    bool handleEvent(const SDL_Event& event);
+
+    /* The keys held, see CPU::setKeys() */
+    uint16_t keypad() const;
+
+    void beep() override;
+    void present(const uint64_t* gfx, uint32_t dirtyRows) override;
+
+private:
+    SDL_Window* win;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    uint16_t keys;
+    uint32_t staleRows; /* Rows of the texture that don't hold the latest frame yet */
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+class CPU;
+
+/* Writes a snapshot of 'cpu' to the file at 'path', see CPU::save() */
+bool save_state_file(const CPU& cpu, const char* path);
+
+/* Restores 'cpu' from a snapshot file written by save_state_file(), see CPU::load() */
+bool load_state_file(CPU& cpu, const char* path);
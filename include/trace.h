@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Tracing of what the CPU does, cheap enough to leave on while chasing timing bugs.
+ *
+ * Which categories are traced is decided at compile time by CHIP8_TRACE_CATEGORIES, a mask of
+ * the CHIP8_TRACE_* bits below (configure with -DCHIP8EMU_TRACE=<mask>). Trace points of
+ * categories that aren't compiled in are dead code and vanish entirely.
+ *
+ * A trace point writes one fixed size binary record into a ring buffer that belongs to the
+ * calling thread, so it never takes a lock or formats anything. Once the ring is full the
+ * oldest records are overwritten. trace_write_file() saves every thread's ring and the
+ * chip8-trace tool turns the file into text.
+ */
+#define CHIP8_TRACE_FETCH  (1 << 0) /* Every instruction that is interpreted (not JIT or AOT blocks) */
+#define CHIP8_TRACE_BRANCH (1 << 1) /* Jumps, calls and returns */
+#define CHIP8_TRACE_DRAW   (1 << 2) /* Sprites and clears */
+#define CHIP8_TRACE_INPUT  (1 << 3) /* FX0A waiting and the key presses that end it */
+#define CHIP8_TRACE_TIMING (1 << 4) /* Idle loops that were skipped */
+
+#ifndef CHIP8_TRACE_CATEGORIES
+    #define CHIP8_TRACE_CATEGORIES (0)
+#endif
+
+/* Records per thread, a power of two */
+#define CHIP8_TRACE_RING_SIZE (1 << 16)
+
+/* Every kind of record and what its two operands hold */
+#define CHIP8_TRACE_EVENTS(X) \
+    X(Fetch)    /* a: opcode */ \
+    X(Jump)     /* a: target */ \
+    X(Call)     /* a: target, b: stack depth after the call */ \
+    X(Return)   /* a: return address, b: stack depth after the return */ \
+    X(Draw)     /* a: x | y << 8, b: height | collision << 8 */ \
+    X(Clear)    \
+    X(KeyWait)  /* a: register */ \
+    X(KeyPress) /* a: key */ \
+    X(IdleSkip) /* a: instructions skipped */
+
+enum class TraceEvent : uint8_t {
+#define CHIP8_TRACE_EVENT_ENUM(name) name,
+    CHIP8_TRACE_EVENTS(CHIP8_TRACE_EVENT_ENUM)
+#undef CHIP8_TRACE_EVENT_ENUM
+    COUNT
+};
+
+struct TraceRecord {
+    uint32_t sequence; /* Counts the thread's records, so gaps show where the ring wrapped */
+    TraceEvent event;
+    uint8_t reserved;
+    uint16_t pc;
+    uint32_t a;
+    uint32_t b;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "Trace records are meant to be 16 bytes");
+
+struct TraceRing {
+    TraceRecord records[CHIP8_TRACE_RING_SIZE];
+    std::atomic<uint32_t> next; /* Sequence number of the next record */
+    uint32_t thread;            /* Numbered in the order threads first traced something */
+};
+
+/* The calling thread's ring, created on first use */
+extern thread_local TraceRing* trace_ring;
+TraceRing* trace_attach();
+
+inline void trace_record(TraceEvent event, uint16_t pc, uint32_t a, uint32_t b)
+{
+    TraceRing* ring = trace_ring != nullptr ? trace_ring : trace_attach();
+    const uint32_t n = ring->next.load(std::memory_order_relaxed);
+    ring->records[n & (CHIP8_TRACE_RING_SIZE - 1)] = { n, event, 0, pc, a, b };
+    ring->next.store(n + 1, std::memory_order_release);
+}
+
+#define CHIP8_TRACE(category, event, pc, a, b) \
+    do { \
+        if (CHIP8_TRACE_CATEGORIES & (category)) { \
+            trace_record(TraceEvent::event, (pc), (a), (b)); \
+        } \
+    } while (0)
+
+/* Whether any category was compiled in */
+inline bool trace_enabled()
+{
+    return CHIP8_TRACE_CATEGORIES != 0;
+}
+
+/* The name of 'event', e.g. "Fetch" */
+const char* trace_event_name(TraceEvent event);
+
+/*
+ * Writes every thread's ring to 'path'. Records written while this runs may or may not make
+ * it, so it's best called once the emulation has stopped.
+ */
+bool trace_write_file(const char* path);
+
+/* The layout of a trace file: this header, then per ring a TraceFileRing followed by its records, oldest first */
+struct TraceFileHeader {
+    char magic[4]; /* "C8TR" */
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t ringCount;
+};
+
+struct TraceFileRing {
+    uint32_t thread;
+    uint32_t count;
+};
+
+#define CHIP8_TRACE_FILE_VERSION (1)
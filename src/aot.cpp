@@ -0,0 +1,62 @@
+#include "aot.h"
+#include "cpu.h"
+#include <cstring>
+
+AotRuntime::AotRuntime(const AotProgram& program) : program(program)
+{
+    std::memset(blocks, 0, sizeof(blocks));
+    for (size_t i = 0; i < program.blockCount; ++i) {
+        const AotBlock& block = program.blocks[i];
+        if (block.start < CHIP8_MEMORY_SIZE) {
+            blocks[block.start] = &block;
+        }
+    }
+}
+
+bool AotRuntime::matches(const uint8_t* memory) const
+{
+    if (program.romSize > CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS) {
+        return false;
+    }
+    return std::memcmp(memory + CHIP8_START_ADDRESS, program.rom, program.romSize) == 0;
+}
+
+uint32_t AotRuntime::run(CPU& cpu, uint32_t cycles)
+{
+    AotContext context = { cpu.V, cpu.stack, cpu.sp, cpu.index, cpu.pc };
+
+    uint32_t executed = 0;
+    while (executed < cycles) {
+        const AotBlock* block = cpu.pc < CHIP8_MEMORY_SIZE ? blocks[cpu.pc] : nullptr;
+        /* A block runs to its end, so one that runUntil()'s address is in the middle of is interpreted */
+        const bool stopsInside = block != nullptr && cpu.stopPc > cpu.pc && cpu.stopPc < block->end;
+        if (block != nullptr && block->count <= cycles - executed && !stopsInside) {
+            block->run(context);
+            executed += block->count;
+        } else {
+            cpu.execute(cpu.fetch());
+            ++executed;
+            if (cpu.suspended) {
+                break;
+            }
+        }
+        if (cpu.pc == cpu.stopPc) {
+            cpu.stopEvent = CHIP8_STOP_PC;
+            break;
+        }
+    }
+    return executed;
+}
+
+void AotRuntime::invalidate(uint16_t address, uint16_t length)
+{
+    const uint32_t maxBlockBytes = CHIP8_AOT_MAX_BLOCK_INSTRUCTIONS * 2;
+    const uint32_t first = address > maxBlockBytes ? address - maxBlockBytes : 0;
+    const uint32_t end = static_cast<uint32_t>(address) + length;
+    for (uint32_t s = first; s < end && s < CHIP8_MEMORY_SIZE; ++s) {
+        if (blocks[s] != nullptr && blocks[s]->end > address) {
+            /* The code was overwritten so the translation no longer applies */
+            blocks[s] = nullptr;
+        }
+    }
+}
@@ -0,0 +1,217 @@
+#include "batch.h"
+#include "headless.h"
+#include "rom.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+/* How many frames a job runs between checks of its time limit */
+static const uint64_t FRAMES_PER_TIME_CHECK = 4096;
+
+using Clock = std::chrono::steady_clock;
+
+static bool list_directory(const std::string& dir, std::vector<std::string>& files)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            files.push_back(dir + "\\" + data.cFileName);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR* handle = opendir(dir.c_str());
+    if (handle == nullptr) {
+        return false;
+    }
+    while (const dirent* entry = readdir(handle)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        const std::string path = dir + "/" + entry->d_name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            files.push_back(path);
+        }
+    }
+    closedir(handle);
+#endif
+    std::sort(files.begin(), files.end());
+    return true;
+}
+
+std::vector<std::string> list_batch_roms(const char* path)
+{
+    std::vector<std::string> roms;
+    if (list_directory(path, roms)) {
+        return roms;
+    }
+
+    std::ifstream list(path);
+    std::string line;
+    while (std::getline(list, line)) {
+        /* Tolerate Windows line endings and blank lines */
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            roms.push_back(line);
+        }
+    }
+    return roms;
+}
+
+const char* batch_exit_name(BatchExit exit)
+{
+    switch (exit) {
+    case BatchExit::Cycles:
+        return "cycles";
+    case BatchExit::Time:
+        return "time";
+    case BatchExit::KeyWait:
+        return "key-wait";
+    case BatchExit::LoadError:
+        return "load-error";
+    case BatchExit::Error:
+        return "error";
+    }
+    return "unknown";
+}
+
+static void run_job(const BatchOptions& options, BatchResult& result)
+{
+    const Clock::time_point start = Clock::now();
+
+    RomFile rom;
+    if (rom.open(result.romPath.c_str()) != RomError::None) {
+        result.exit = BatchExit::LoadError;
+        return;
+    }
+
+    /* The CPU is too large to comfortably live on a worker's stack */
+    auto cpu = std::make_unique<CPU>(rom.data(), rom.size());
+    HeadlessHost host;
+    cpu->setHost(&host);
+    cpu->setEngine(options.engine);
+    cpu->setSeed(result.seed);
+
+    const Clock::time_point deadline = start + std::chrono::milliseconds(options.timeLimitMs);
+    const uint64_t cyclesPerCheck = FRAMES_PER_TIME_CHECK * options.instructionsPerFrame;
+    result.exit = BatchExit::Cycles;
+    while (result.cycles < options.cycles) {
+        const uint64_t remaining = options.cycles - result.cycles;
+        const HeadlessResult slice = run_headless(*cpu, host, std::min(remaining, cyclesPerCheck), options.instructionsPerFrame);
+        result.cycles += slice.cycles;
+        result.idleCycles += slice.idleCycles;
+        result.frames += slice.frames;
+        if (cpu->isWaitingForKey()) {
+            result.exit = BatchExit::KeyWait;
+            break;
+        }
+        if (options.timeLimitMs != 0 && Clock::now() >= deadline) {
+            result.exit = BatchExit::Time;
+            break;
+        }
+    }
+    result.framebufferHash = hash_framebuffer(cpu->getGFX());
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+namespace {
+
+/* A job queue owned by one worker. The owner pops from the back and thieves take from the front. */
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+
+    bool pop(size_t& job)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+
+    bool steal(size_t& job)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+};
+
+} // namespace
+
+std::vector<BatchResult> run_batch(const std::vector<std::string>& roms, const BatchOptions& options)
+{
+    const uint32_t seeds = std::max(options.seedsPerRom, 1u);
+    std::vector<BatchResult> results(roms.size() * seeds);
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i] = { roms[i / seeds], options.seed + i % seeds, BatchExit::LoadError, 0, 0, 0, 0, 0.0 };
+    }
+
+    unsigned threads = options.threads != 0 ? options.threads : std::thread::hardware_concurrency();
+    threads = std::max(1u, std::min(threads, static_cast<unsigned>(std::max<size_t>(results.size(), 1))));
+
+    /* Deal the jobs out round robin; stealing evens out whatever imbalance is left */
+    std::vector<WorkQueue> queues(threads);
+    for (size_t i = 0; i < results.size(); ++i) {
+        queues[i % threads].jobs.push_back(i);
+    }
+
+    /* Jobs never spawn other jobs so a worker is done once every queue is empty */
+    std::atomic<size_t> remaining(results.size());
+    auto worker = [&](unsigned self) {
+        while (remaining.load() != 0) {
+            size_t job;
+            bool found = queues[self].pop(job);
+            for (unsigned i = 1; !found && i < threads; ++i) {
+                found = queues[(self + i) % threads].steal(job);
+            }
+            if (!found) {
+                break;
+            }
+            /* A job that throws only fails itself, an exception leaving a worker would end the batch */
+            try {
+                run_job(options, results[job]);
+            } catch (...) {
+                results[job].exit = BatchExit::Error;
+            }
+            --remaining;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i) {
+        pool.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return results;
+}
@@ -0,0 +1,231 @@
+#include "chip8.h"
+#include "cpu.h"
+#include "headless.h"
+#include "rng.h"
+#include "rom.h"
+#include "scheduler.h"
+#include <cstring>
+#include <new>
+
+static_assert(CHIP8_SCREEN_WIDTH == CHIP8_PIXELS_WIDTH && CHIP8_SCREEN_HEIGHT == CHIP8_PIXELS_HEIGHT,
+              "The C interface describes the same screen as the core");
+static_assert(CHIP8_RUN_STOP_DRAW == CHIP8_STOP_DRAW && CHIP8_RUN_STOP_KEY_WAIT == CHIP8_STOP_KEY_WAIT &&
+              CHIP8_RUN_STOP_PC == CHIP8_STOP_PC && CHIP8_RUN_STOP_SOUND == CHIP8_STOP_SOUND,
+              "The C interface stops at the same events as the core");
+
+struct chip8 {
+    std::unique_ptr<CPU> cpu;
+    HeadlessHost host; /* Only beeps are of interest, the screen is fetched with chip8_get_framebuffer() */
+    uint64_t beepsTaken;
+    Engine engine;
+    uint64_t seed;
+    uint32_t instructionsPerFrame;
+};
+
+static Engine to_engine(chip8_engine engine)
+{
+    switch (engine) {
+    case CHIP8_ENGINE_THREADED: return Engine::Threaded;
+    case CHIP8_ENGINE_JIT:      return Engine::Jit;
+    case CHIP8_ENGINE_SWITCH:
+    default:                    return Engine::Switch;
+    }
+}
+
+/* A machine running 'rom' with the settings of 'machine', or null if out of memory. Nothing may throw past the C interface. */
+static std::unique_ptr<CPU> make_cpu(chip8& machine, const uint8_t* rom, size_t size)
+{
+    try {
+        std::unique_ptr<CPU> cpu(new CPU(rom, size));
+        cpu->setEngine(machine.engine);
+        cpu->setSeed(machine.seed);
+        cpu->setHost(&machine.host);
+        return cpu;
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+chip8* chip8_create(void)
+{
+    chip8* machine = new (std::nothrow) chip8();
+    if (machine == nullptr) {
+        return nullptr;
+    }
+    machine->beepsTaken = 0;
+    machine->engine = CPU::hasEngine(Engine::Threaded) ? Engine::Threaded : Engine::Switch;
+    machine->seed = CHIP8_DEFAULT_SEED;
+    machine->instructionsPerFrame = CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME;
+    machine->cpu = make_cpu(*machine, nullptr, 0);
+    if (machine->cpu == nullptr) {
+        delete machine;
+        return nullptr;
+    }
+    return machine;
+}
+
+void chip8_destroy(chip8* machine)
+{
+    delete machine;
+}
+
+chip8_status chip8_load_rom(chip8* machine, const uint8_t* rom, size_t size)
+{
+    if (machine == nullptr || (rom == nullptr && size != 0)) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    if (size > CHIP8_MAX_ROM_SIZE) {
+        return CHIP8_ERROR_ROM_TOO_LARGE;
+    }
+    std::unique_ptr<CPU> cpu = make_cpu(*machine, rom, size);
+    if (cpu == nullptr) {
+        return CHIP8_ERROR_MEMORY;
+    }
+    machine->cpu = std::move(cpu);
+    return CHIP8_OK;
+}
+
+chip8_status chip8_load_rom_file(chip8* machine, const char* path)
+{
+    if (machine == nullptr || path == nullptr) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    RomFile rom;
+    switch (rom.open(path)) {
+    case RomError::None:     break;
+    case RomError::TooLarge: return CHIP8_ERROR_ROM_TOO_LARGE;
+    default:                 return CHIP8_ERROR_IO;
+    }
+    std::unique_ptr<CPU> cpu = make_cpu(*machine, rom.data(), rom.size());
+    if (cpu == nullptr) {
+        return CHIP8_ERROR_MEMORY;
+    }
+    machine->cpu = std::move(cpu);
+    return CHIP8_OK;
+}
+
+chip8_status chip8_set_engine(chip8* machine, chip8_engine engine)
+{
+    if (machine == nullptr || engine < CHIP8_ENGINE_SWITCH || engine > CHIP8_ENGINE_JIT) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    machine->engine = to_engine(engine);
+    try {
+        machine->cpu->setEngine(machine->engine);
+    } catch (const std::bad_alloc&) {
+        return CHIP8_ERROR_MEMORY;
+    }
+    return CHIP8_OK;
+}
+
+chip8_status chip8_set_seed(chip8* machine, uint64_t seed)
+{
+    if (machine == nullptr) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    machine->seed = seed;
+    machine->cpu->setSeed(seed);
+    return CHIP8_OK;
+}
+
+chip8_status chip8_set_instructions_per_frame(chip8* machine, uint32_t instructions)
+{
+    if (machine == nullptr || instructions == 0) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    machine->instructionsPerFrame = instructions;
+    return CHIP8_OK;
+}
+
+uint64_t chip8_run_cycles(chip8* machine, uint64_t cycles)
+{
+    if (machine == nullptr) {
+        return 0;
+    }
+    return machine->cpu->runCycles(cycles);
+}
+
+chip8_status chip8_run_until(chip8* machine, uint32_t events, uint64_t cycles, uint16_t pc, chip8_run_result* result)
+{
+    if (machine == nullptr || result == nullptr) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    const RunResult run = machine->cpu->runUntil(events, cycles, pc);
+    result->executed = run.executed;
+    result->event = run.event;
+    return CHIP8_OK;
+}
+
+uint64_t chip8_run_frame(chip8* machine)
+{
+    return chip8_run_frames(machine, 1);
+}
+
+uint64_t chip8_run_frames(chip8* machine, uint32_t frames)
+{
+    if (machine == nullptr) {
+        return 0;
+    }
+    CPU& cpu = *machine->cpu;
+    uint64_t executed = 0;
+    for (uint32_t f = 0; f < frames; ++f) {
+        executed += cpu.runFrame(machine->instructionsPerFrame);
+    }
+    return executed;
+}
+
+chip8_status chip8_set_keys(chip8* machine, uint16_t keys)
+{
+    if (machine == nullptr) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    machine->cpu->setKeys(keys);
+    return CHIP8_OK;
+}
+
+int chip8_is_waiting_for_key(const chip8* machine)
+{
+    return machine != nullptr && machine->cpu->isWaitingForKey();
+}
+
+uint32_t chip8_get_framebuffer(chip8* machine, uint64_t rows[CHIP8_SCREEN_HEIGHT])
+{
+    if (machine == nullptr || rows == nullptr) {
+        return 0;
+    }
+    std::memcpy(rows, machine->cpu->getGFX(), CHIP8_SCREEN_HEIGHT * sizeof(uint64_t));
+    const uint32_t dirtyRows = machine->cpu->getDirtyRows();
+    machine->cpu->setDraw(false);
+    return dirtyRows;
+}
+
+uint32_t chip8_take_beeps(chip8* machine)
+{
+    if (machine == nullptr) {
+        return 0;
+    }
+    const uint64_t beeps = machine->host.beeps - machine->beepsTaken;
+    machine->beepsTaken = machine->host.beeps;
+    return static_cast<uint32_t>(beeps);
+}
+
+size_t chip8_snapshot_size(void)
+{
+    return CPU::snapshotSize();
+}
+
+chip8_status chip8_snapshot(const chip8* machine, void* buffer, size_t size)
+{
+    if (machine == nullptr || buffer == nullptr) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    return machine->cpu->save(static_cast<uint8_t*>(buffer), size) ? CHIP8_OK : CHIP8_ERROR_SNAPSHOT;
+}
+
+chip8_status chip8_restore(chip8* machine, const void* buffer, size_t size)
+{
+    if (machine == nullptr || buffer == nullptr) {
+        return CHIP8_ERROR_ARGUMENT;
+    }
+    return machine->cpu->load(static_cast<const uint8_t*>(buffer), size) ? CHIP8_OK : CHIP8_ERROR_SNAPSHOT;
+}
@@ -1,8 +1,20 @@
 #include "cpu.h"
+#include "aot.h"
+#include "framebuffer.h"
+#include "jit.h"
+#include "rng.h"
+#include "trace.h"
+#include <cstddef>
 #include <cstring>
-#include <iostream>
+#include <type_traits>
 
-static const uint8_t CHIP8_FONTSET[CHIP8_FONT_COUNT] =
+#if defined(CHIP8EMU_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+    #define CHIP8_HAS_THREADED_DISPATCH 1
+#else
+    #define CHIP8_HAS_THREADED_DISPATCH 0
+#endif
+
+const uint8_t CHIP8_FONTSET[CHIP8_FONT_COUNT] =
 {
   0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
   0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -22,471 +34,820 @@ static const uint8_t CHIP8_FONTSET[CHIP8_FONT_COUNT] =
   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-static const int CHIP8_KEYMAP[CHIP8_KEY_COUNT] = {
-    SDLK_0,
-    SDLK_1,
-    SDLK_2,
-    SDLK_3,
-    SDLK_4,
-    SDLK_5,
-    SDLK_6,
-    SDLK_7,
-    SDLK_8,
-    SDLK_9,
-    SDLK_a,
-    SDLK_b,
-    SDLK_c,
-    SDLK_d,
-    SDLK_e,
-    SDLK_f
+/* Stands in until a real host is attached */
+class NullHost : public Host {
+public:
+    void beep() override {}
+    void present(const uint64_t*, uint32_t) override {}
 };
 
-CPU::CPU(ROM rom) 
-    : sp(0), opcode(0), index(0), pc(CHIP8_START_ADDRESS), 
-    delay_timer(0), sound_timer(0), need_draw(false)
-{
-    /* Clear all registers, stack, keys, graphics */
-    std::memset(V, 0, sizeof(V));
-    std::memset(gfx, 0, sizeof(gfx));
-    std::memset(stack, 0, sizeof(stack));
-    std::memset(key, 0, sizeof(key));
+static NullHost NULL_HOST;
 
-    /* Clear memory */
-    std::memset(memory, 0, sizeof(memory));
+/* Longest loop findIdleLoop() recognizes */
+static const uint32_t MAX_IDLE_LOOP_INSTRUCTIONS = 8;
+
+CPU::CPU(const uint8_t* rom, size_t size)
+    : CPUState(), host(&NULL_HOST), suspended(false), idleLoopLength(0), skippedCycles(0),
+    stopEvents(0), stopEvent(0), stopPc(NO_STOP_PC), engine(Engine::Switch)
+#ifdef CHIP8EMU_PROFILE
+    , profile()
+#endif
+{
+    /* CPUState() cleared the memory, registers, stack, keys and graphics */
+    pc = CHIP8_START_ADDRESS;
+    rng = rng_seed(CHIP8_DEFAULT_SEED);
 
     /* Load font into memory */
     std::memcpy(memory, CHIP8_FONTSET, sizeof(CHIP8_FONTSET));
 
     /* Load game into memory */
-    std::memcpy(memory + CHIP8_START_ADDRESS, rom.get(), CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS);
+    if (size > CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS) {
+        size = CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS;
+    }
+    if (size != 0) {
+        std::memcpy(memory + CHIP8_START_ADDRESS, rom, size);
+    }
+
+    /* Nothing has been decoded yet */
+    invalidate(0, CHIP8_MEMORY_SIZE);
 }
 
+CPU::~CPU() = default;
+
 void CPU::dump()
 {
     for (int i = 0; i < CHIP8_REGISTER_COUNT; ++i) {
         LOG("V[%d] : 0x%02X", i, V[i]);
     }
 
-    for (int i = 0; i < CHIP8_KEY_COUNT; ++i) {
-        LOG("K[%d] : 0x%02X", i, key[i]);
-    }
+    LOG("Keys : 0x%04X", keys);
+}
+
+#ifdef CHIP8EMU_PROFILE
+const Profile& CPU::getProfile() const
+{
+    return profile;
 }
 
+void CPU::resetProfile()
+{
+    profile = Profile();
+}
+#endif
+
 void CPU::emulate_cycle()
 {
-    opcode = next();
-    LOG("Fetched 0x%04X", opcode);
-    decode(opcode);
+    const Instruction& ins = fetch();
+    CHIP8_PROFILE_BEGIN(pc, ins.op);
+    execute(ins);
+    CHIP8_PROFILE_END(profile);
+}
+
+void CPU::tickTimers()
+{
     if (delay_timer > 0) {
         --delay_timer;
     }
 
     if (sound_timer > 0) {
-        if (sound_timer == 1) {
-            std::cout << "BEEP!\n";
+        if (--sound_timer == 0) {
+            host->beep();
         }
-        --sound_timer;
     }
 }
 
-void CPU::decode(uint16_t op)
+bool CPU::hasEngine(Engine engine)
 {
-    const uint16_t high = op & 0xF000;
-    switch (high) {
-    case 0x0000:
-        process0(op);
-        break;
-    case 0x1000:
-        process1(op);
-        break;
-    case 0x2000:
-        process2(op);
-        break;
-    case 0x3000:
-        process3(op);
-        break;
-    case 0x4000:
-        process4(op);
-        break;
-    case 0x5000:
-        process5(op);
-        break;
-    case 0x6000:
-        process6(op);
-        break;
-    case 0x7000:
-        process7(op);
-        break;
-    case 0x8000:
-        process8(op);
-        break;
-    case 0x9000:
-        process9(op);
-        break;
-    case 0xA000:
-        processA(op);
-        break;
-    case 0xB000:
-        processB(op);
-        break;
-    case 0xC000:
-        processC(op);
-        break;
-    case 0xD000:
-        processD(op);
-        break;
-    case 0xE000:
-        processE(op);
-        break;
-    case 0xF000:
-        processF(op);
-        break;
+    switch (engine) {
+    case Engine::Threaded:
+        return CHIP8_HAS_THREADED_DISPATCH;
+    case Engine::Jit:
+        return Jit::available();
+    case Engine::Aot:
+    case Engine::Switch:
     default:
-        LOG("%d is an invalid opcode!", op);
-        break;
+        return true;
     }
 }
 
-void CPU::processF(uint16_t op)
+void CPU::setEngine(Engine e)
 {
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint16_t low = op & 0x00FF;
-    switch (low) {
-    case 0x0007:
-        /* DELA */
-        V[X] = delay_timer;
-        pc += 2;
-        break;
-    case 0x000A:
-    {
-        /* KEYW */
-        const uint8_t *keys = SDL_GetKeyboardState(nullptr);
-        for (uint8_t i = 0; i < CHIP8_KEY_COUNT; ++i) {
-            if (keys[CHIP8_KEYMAP[i]]) {
-                V[X] = i;
-                pc += 2;
-            }
-        }
+    engine = hasEngine(e) ? e : Engine::Switch;
+    if (engine == Engine::Jit && !jit) {
+        jit = std::make_unique<Jit>();
     }
-    break;
-    case 0x0015:
-        /* DELR */
-        delay_timer = V[X];
-        pc += 2;
-        break;
-    case 0x0018:
-        /* SNDR */
-        sound_timer = V[X];
-        pc += 2;
-        break;
-    case 0x001E:
-        /* IADD */
-        index += V[X];
-        pc += 2;
-        break;
-    case 0x0029:
-        /* SILS */
-        index = V[X] * 5;
-        pc += 2;
-        break;
-    case 0x0033:
-        /* BCD -- Store "102" as "1", "0", "2" in memory */
-        memory[index] = V[X] / 100;
-        memory[index + 1] = (V[X] / 10) % 10;
-        memory[index + 2] = (V[X] % 100) % 10;
-        pc += 2;
-        break;
-    case 0x0055:
-        /* DUMP */
-        for (int i = 0; i <= X; ++i) {
-            memory[index + i] = V[i];
+    if (engine == Engine::Jit && !jit->usable()) {
+        LOG("The JIT has no code cache, falling back to the switch engine.");
+        engine = Engine::Switch;
+    }
+    if (engine == Engine::Aot && !aot) {
+        LOG("Engine %d needs a program to be loaded, falling back to the switch engine.", static_cast<int>(e));
+        engine = Engine::Switch;
+    }
+}
+
+bool CPU::loadProgram(const AotProgram& program)
+{
+    auto runtime = std::make_unique<AotRuntime>(program);
+    if (!runtime->matches(memory)) {
+        return false;
+    }
+    aot = std::move(runtime);
+    return true;
+}
+
+uint32_t CPU::run(uint32_t cycles)
+{
+    uint32_t executed = 0;
+    while (executed < cycles && !waiting_for_key) {
+        executed += dispatch(cycles - executed);
+        if (idleLoopLength != 0) {
+            /* Nothing changes from one trip around the loop to the next until the timers tick */
+            const uint32_t remaining = cycles - executed;
+            const uint32_t skipped = remaining - remaining % idleLoopLength;
+            executed += skipped;
+            skippedCycles += skipped;
+            CHIP8_TRACE(CHIP8_TRACE_TIMING, IdleSkip, pc, skipped, 0);
+            idleLoopLength = 0;
         }
-        pc += 2;
-        break;
-    case 0x0065:
-        /* IDUMP */
-        for (int i = 0; i <= X; ++i) {
-            V[i] = memory[index + i];
+        suspended = false;
+        if (stopEvent != 0) {
+            break;
         }
-        pc += 2;
-        break;
-    default:
-        LOG("processF() 0x%04X is not recognized.", op);
-        break;
     }
+    /* Stepping past 0xFFE leaves the pc past the end until the next fetch, snapshots never see that */
+    pc &= CHIP8_ADDRESS_MASK;
+    return executed;
 }
 
-void CPU::processE(uint16_t op)
+uint64_t CPU::runCycles(uint64_t cycles)
 {
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint16_t low = op & 0x00FF;
-    switch (low) {
-    case 0x009E:
-        /* SKK */
-        if (key[X]) {
-            pc += 4;
-        } else {
-            pc += 2;
-        }
-        break;
-    case 0x00A1:
-        /* SKNK */
-        if (!key[X]) {
-            pc += 4;
-        } else {
-            pc += 2;
+    uint64_t executed = 0;
+    while (executed < cycles && !waiting_for_key) {
+        const uint64_t remaining = cycles - executed;
+        executed += run(static_cast<uint32_t>(remaining < UINT32_MAX ? remaining : UINT32_MAX));
+    }
+    return executed;
+}
+
+uint32_t CPU::runFrame(uint32_t instructionsPerFrame)
+{
+    const uint32_t executed = run(instructionsPerFrame);
+    tickTimers();
+    return executed;
+}
+
+RunResult CPU::runUntil(uint32_t events, uint64_t cycles, uint16_t stopAt)
+{
+    stopEvents = events;
+    stopEvent = 0;
+    stopPc = (events & CHIP8_STOP_PC) ? static_cast<uint16_t>(stopAt & (CHIP8_MEMORY_SIZE - 1)) : NO_STOP_PC;
+
+    RunResult result = { 0, 0 };
+    while (result.executed < cycles && !waiting_for_key && stopEvent == 0) {
+        const uint64_t remaining = cycles - result.executed;
+        result.executed += run(static_cast<uint32_t>(remaining < UINT32_MAX ? remaining : UINT32_MAX));
+    }
+    result.event = stopEvent != 0 ? stopEvent : (waiting_for_key ? CHIP8_STOP_KEY_WAIT : 0);
+
+    stopEvents = 0;
+    stopEvent = 0;
+    stopPc = NO_STOP_PC;
+    return result;
+}
+
+uint64_t CPU::idleCycles() const
+{
+    return skippedCycles;
+}
+
+uint32_t CPU::dispatch(uint32_t cycles)
+{
+    switch (engine) {
+    case Engine::Threaded:
+        return runThreaded(cycles);
+    case Engine::Jit:
+        if (!jit->usable()) {
+            /* The cache was released because it couldn't be made executable */
+            engine = Engine::Switch;
+            return runSwitch(cycles);
         }
-        break;
+        return jit->run(*this, cycles);
+    case Engine::Aot:
+        return aot->run(*this, cycles);
+    case Engine::Switch:
     default:
-        LOG("processE() 0x%04X isn't recognized.", op);
-        break;
-    }
-}
-
-void CPU::processD(uint16_t op)
-{
-    /* DRAW */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t Y = (op & 0x00F0) >> 4;
-
-    const uint8_t col = V[X];
-    const uint8_t row = V[Y];
-    const uint8_t height = op & 0x000F;
-
-    V[0xF] = 0; /* Clear the collision bit */
-    for (uint8_t h = 0; h < height; ++h) {
-        /* Now read in a row of 8 sprite pixels */
-        const uint8_t spriteRow = memory[index + h];
-        LOG("0x%02X sprite row read from 0x%04X", spriteRow, index + h);
-        for (uint8_t b = 0; b < 8; ++b) {
-            /* Check if the bit is set in the sprite */
-            if (spriteRow & (0x0080 >> b)) {
-                /* 
-                The offset into the graphics is obtained through letting 'b'
-                represent a single pixel in the X position since spriteRow is a byte containing 8 pixels' worth of data.
-                We then add that as an offset into V[X] and V[Y].
-                */
-                const int offset = col + b + ((row + h) * CHIP8_PIXELS_WIDTH);
-                if (gfx[offset] == 1) {
-                    V[0xF] = 1; /* Collision! This happens since XOR'ing 1 and 1 will result in 0. */
-                }
-                gfx[offset] ^= 1;
-            }
+        return runSwitch(cycles);
+    }
+}
+
+uint32_t CPU::runSwitch(uint32_t cycles)
+{
+    uint32_t executed = 0;
+    while (executed < cycles && !suspended) {
+        emulate_cycle();
+        ++executed;
+        /* Like the other engines, an instruction that stopped the run keeps its own event */
+        if (pc == stopPc && !suspended) {
+            stopEvent = CHIP8_STOP_PC;
+            break;
         }
     }
-    need_draw = true;
+    return executed;
+}
+
+#if CHIP8_HAS_THREADED_DISPATCH
+/*
+ * Labels as values are a GNU extension so -Wpedantic has to look the other way.
+ * Every handler ends with its own copy of the indirect jump to the next handler,
+ * which gives the branch predictor one history per instruction instead of one
+ * shared jump for all of them.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+uint32_t CPU::runThreaded(uint32_t cycles)
+{
+    static void* const LABELS[] = {
+#define CHIP8_OP_LABEL(name) &&exec_##name,
+        CHIP8_INSTRUCTIONS(CHIP8_OP_LABEL)
+#undef CHIP8_OP_LABEL
+    };
+
+    uint32_t executed = 0;
+    const Instruction* ins = nullptr;
+
+#define CHIP8_DISPATCH() \
+    do { \
+        if (executed == cycles) { \
+            return executed; \
+        } \
+        ++executed; \
+        ins = &fetch(); \
+        goto *LABELS[static_cast<size_t>(ins->op)]; \
+    } while (0)
+
+    CHIP8_DISPATCH();
+
+    /* Only a few instructions can suspend execution, the check folds away for every other one */
+#define CHIP8_OP_BODY(name) \
+    exec_##name: { \
+        CHIP8_PROFILE_BEGIN(pc, Op::name); \
+        exec##name(*ins); \
+        CHIP8_PROFILE_END(profile); \
+    } \
+        if ((Op::name == Op::KEYW || Op::name == Op::DELA || Op::name == Op::DRAW || \
+             Op::name == Op::CLR || Op::name == Op::SNDR) && suspended) { \
+            return executed; \
+        } \
+        if (pc == stopPc) { \
+            stopEvent = CHIP8_STOP_PC; \
+            return executed; \
+        } \
+        CHIP8_DISPATCH();
+
+    CHIP8_INSTRUCTIONS(CHIP8_OP_BODY)
+
+#undef CHIP8_OP_BODY
+#undef CHIP8_DISPATCH
+}
+#pragma GCC diagnostic pop
+#else
+uint32_t CPU::runThreaded(uint32_t cycles)
+{
+    return runSwitch(cycles);
+}
+#endif
+
+void CPU::decode(uint16_t op)
+{
+    execute(decode_instruction(op));
+}
+
+const Instruction& CPU::fetch()
+{
+    pc &= CHIP8_ADDRESS_MASK;
+    CHIP8_TRACE(CHIP8_TRACE_FETCH, Fetch, pc, next(), 0);
+    Instruction& slot = icache[pc];
+    if (slot.op == Op::DECODE) {
+        slot = decode_instruction(next());
+    }
+    return slot;
+}
+
+void CPU::execute(const Instruction& ins)
+{
+    /* A dense switch lets the compiler inline every handler behind one jump table */
+    switch (ins.op) {
+#define CHIP8_OP_CASE(name) case Op::name: exec##name(ins); break;
+    CHIP8_INSTRUCTIONS(CHIP8_OP_CASE)
+#undef CHIP8_OP_CASE
+    default: LOG("Op %d can't be executed!", static_cast<int>(ins.op)); break;
+    }
+}
+
+void CPU::invalidate(uint16_t address, uint16_t length)
+{
+    /* Writes wrap around the end of memory like reads do */
+    address &= CHIP8_ADDRESS_MASK;
+    if (static_cast<uint32_t>(address) + length > CHIP8_MEMORY_SIZE) {
+        const uint16_t first = static_cast<uint16_t>(CHIP8_MEMORY_SIZE - address);
+        invalidate(address, first);
+        invalidate(0, static_cast<uint16_t>(length - first));
+        return;
+    }
+
+    const Instruction stale = { Op::DECODE, 0, 0, 0, 0, 0 };
+
+    /* An instruction starting one byte before the write overlaps it as well, 0xFFF overlaps 0x000 */
+    icache[(address - 1) & CHIP8_ADDRESS_MASK] = stale;
+    for (uint32_t a = address; a < static_cast<uint32_t>(address) + length; ++a) {
+        icache[a] = stale;
+    }
+
+    if (jit) {
+        jit->invalidate(address, length);
+    }
+    if (aot) {
+        aot->invalidate(address, length);
+    }
+}
+
+void CPU::execINVALID(const Instruction&)
+{
+    LOG("0x%04X at 0x%04X is an invalid opcode!", next(), pc);
+}
+
+void CPU::execIDUMP(const Instruction& ins)
+{
+    for (int i = 0; i <= ins.X; ++i) {
+        V[i] = memory[(index + i) & CHIP8_ADDRESS_MASK];
+    }
+    pc += 2;
+}
+
+void CPU::execDUMP(const Instruction& ins)
+{
+    /* The write may land on this very instruction so grab X before invalidating */
+    const uint8_t X = ins.X;
+    for (int i = 0; i <= X; ++i) {
+        memory[(index + i) & CHIP8_ADDRESS_MASK] = V[i];
+    }
+    invalidate(index, X + 1);
+    pc += 2;
+}
+
+void CPU::execBCD(const Instruction& ins)
+{
+    /* Store "102" as "1", "0", "2" in memory */
+    memory[index & CHIP8_ADDRESS_MASK] = V[ins.X] / 100;
+    memory[(index + 1) & CHIP8_ADDRESS_MASK] = (V[ins.X] / 10) % 10;
+    memory[(index + 2) & CHIP8_ADDRESS_MASK] = (V[ins.X] % 100) % 10;
+    invalidate(index, 3); /* Don't touch 'ins' after this, it may have been invalidated */
+    pc += 2;
+}
+
+void CPU::execSILS(const Instruction& ins)
+{
+    index = V[ins.X] * 5;
     pc += 2;
 }
 
-void CPU::processC(uint16_t op)
+void CPU::execIADD(const Instruction& ins)
 {
-    /* RAND */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t NN = (op & 0x00FF);
-    V[X] = NN & static_cast<uint8_t>(std::rand());
+    index += V[ins.X];
     pc += 2;
 }
 
-void CPU::processB(uint16_t op)
+void CPU::execSNDR(const Instruction& ins)
 {
-    /* ZJMP */
-    pc = (op & 0x0FFF) + V[0];
+    if (sound_timer == 0 && V[ins.X] != 0 && (stopEvents & CHIP8_STOP_SOUND)) {
+        stopEvent = CHIP8_STOP_SOUND;
+        suspended = true;
+    }
+    sound_timer = V[ins.X];
+    pc += 2;
 }
 
-void CPU::processA(uint16_t op)
+void CPU::execDELR(const Instruction& ins)
 {
-    /* ILOAD */
-    index = op & 0x0FFF;
+    delay_timer = V[ins.X];
     pc += 2;
 }
 
-void CPU::process9(uint16_t op)
+void CPU::execKEYW(const Instruction& ins)
+{
+    /* The pc stays on this instruction until setKeys() sees a key go down */
+    CHIP8_TRACE(CHIP8_TRACE_INPUT, KeyWait, pc, ins.X, 0);
+    waiting_for_key = true;
+    suspended = true;
+}
+
+void CPU::execDELA(const Instruction& ins)
 {
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t Y = (op & 0x00F0) >> 4;
-    /* SKRNE */
-    if (V[X] != V[Y]) {
+    V[ins.X] = delay_timer;
+    pc += 2;
+    checkIdleLoop();
+}
+
+/* Suspends the CPU when the FX07 just before pc starts an idle loop */
+void CPU::checkIdleLoop()
+{
+    /* Skipping trips around the loop could skip over the address runUntil() is waiting for */
+    idleLoopLength = stopPc == NO_STOP_PC ? findIdleLoop() : 0;
+    suspended = idleLoopLength != 0;
+}
+
+/*
+ * Follows the code from pc for one trip around a loop like FX07, 3X00, 1NNN that polls the
+ * delay timer. If the trip only reads the timer, loads constants and branches, and arrives back
+ * at pc with the registers exactly as they are now, every later trip does the same until the
+ * timer ticks. Returns the instructions in one trip, or 0 if this isn't such a loop.
+ */
+uint32_t CPU::findIdleLoop() const
+{
+    uint8_t regs[CHIP8_REGISTER_COUNT];
+    std::memcpy(regs, V, sizeof(regs));
+
+    uint16_t at = pc;
+    for (uint32_t count = 1; count <= MAX_IDLE_LOOP_INSTRUCTIONS; ++count) {
+        const Instruction ins = decode_instruction(memory[at & CHIP8_ADDRESS_MASK] << 8 | memory[(at + 1) & CHIP8_ADDRESS_MASK]);
+        switch (ins.op) {
+        case Op::DELA: regs[ins.X] = delay_timer; at += 2; break;
+        case Op::LOAD: regs[ins.X] = ins.NN; at += 2; break;
+        case Op::SKE: at += regs[ins.X] == ins.NN ? 4 : 2; break;
+        case Op::SKNE: at += regs[ins.X] != ins.NN ? 4 : 2; break;
+        case Op::SKRE: at += regs[ins.X] == regs[ins.Y] ? 4 : 2; break;
+        case Op::SKRNE: at += regs[ins.X] != regs[ins.Y] ? 4 : 2; break;
+        case Op::JMP: at = ins.NNN; break;
+        default:
+            return 0;
+        }
+        if (at == pc) {
+            return std::memcmp(regs, V, sizeof(regs)) == 0 ? count : 0;
+        }
+    }
+    return 0;
+}
+
+void CPU::execSKNK(const Instruction& ins)
+{
+    if (!(keys & (1 << (V[ins.X] & 0xF)))) {
         pc += 4;
     } else {
         pc += 2;
     }
 }
 
-void CPU::process8(uint16_t op)
+void CPU::execSKK(const Instruction& ins)
 {
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t Y = (op & 0x00F0) >> 4;
-    const uint16_t low = op & 0x000F;
-    switch (low) {
-    case 0x0000:
-        /* ASN */
-        V[X] = V[Y];
-        pc += 2;
-        break;
-    case 0x0001:
-        /* OR */
-        V[X] |= V[Y];
-        pc += 2;
-        break;
-    case 0x0002:
-        /* AND */
-        V[X] &= V[Y];
-        pc += 2;
-        break;
-    case 0x0003:
-        /* XOR */
-        V[X] ^= V[Y];
-        pc += 2;
-        break;
-    case 0x0004:
-        /* RADD */
-        if (V[Y] > (0xFF - V[X])) // TODO: visit this logic
-            V[0xF] = 1; /* carry */
-        else
-            V[0xF] = 0;
-        V[X] += V[Y];
-        pc += 2;
-        break;
-    case 0x0005:
-        /* SUB */
-        if (V[Y] > (0xFF - V[X])) // TODO: visit this logic
-            V[0xF] = 0; /* borrow */
-        else
-            V[0xF] = 1;
-        V[X] -= V[Y];
-        pc += 2;
-        break;
-    case 0x0006:
-        /* SHR */
-        V[0xF] = V[X] & 0x1;
-        V[X] >>= 1;
-        pc += 2;
-        break;
-    case 0x0007:
-        /* RSUB */
-        if (V[Y] > (0xFF - V[X])) // TODO: visit this logic
-            V[0xF] = 0; /* borrow */
-        else
-            V[0xF] = 1;
-        V[X] = V[Y] - V[X];
+    if (keys & (1 << (V[ins.X] & 0xF))) {
+        pc += 4;
+    } else {
         pc += 2;
-        break;
-    case 0x000E:
-        /* SHL */
-        V[0xF] = V[X] & 0x8000; // TODO: does this store the 1 and 0 as '1' and '0' or as the value?
-        V[X] <<= 1;
+    }
+}
+
+void CPU::execDRAW(const Instruction& ins)
+{
+    /* The sprite starts wherever V[X], V[Y] wrap to and is clipped at the edges of the screen */
+    const uint8_t col = V[ins.X] % CHIP8_PIXELS_WIDTH;
+    const uint8_t row = V[ins.Y] % CHIP8_PIXELS_HEIGHT;
+    const uint8_t height = ins.N;
+
+    bool collision = false;
+    for (uint8_t h = 0; h < height && row + h < CHIP8_PIXELS_HEIGHT; ++h) {
+        collision |= framebuffer_xor_row(gfx, memory[(index + h) & CHIP8_ADDRESS_MASK], col, row + h);
+    }
+    V[0xF] = collision ? 1 : 0;
+    dirty_rows |= framebuffer_row_mask(row, height);
+    CHIP8_TRACE(CHIP8_TRACE_DRAW, Draw, pc, col | row << 8, height | collision << 8);
+    if (stopEvents & CHIP8_STOP_DRAW) {
+        stopEvent = CHIP8_STOP_DRAW;
+        suspended = true;
+    }
+    pc += 2;
+}
+
+void CPU::execRAND(const Instruction& ins)
+{
+    V[ins.X] = ins.NN & rng_next_byte(rng);
+    pc += 2;
+}
+
+void CPU::execZJMP(const Instruction& ins)
+{
+    pc = (ins.NNN + V[0]) & CHIP8_ADDRESS_MASK;
+}
+
+void CPU::execILOAD(const Instruction& ins)
+{
+    index = ins.NNN;
+    pc += 2;
+}
+
+void CPU::execSKRNE(const Instruction& ins)
+{
+    if (V[ins.X] != V[ins.Y]) {
+        pc += 4;
+    } else {
         pc += 2;
-        break;
-    default:
-        LOG("process8() 0x%04X isn't recognized", op);
-        break;
     }
 }
 
-void CPU::process7(uint16_t op)
+void CPU::execSHL(const Instruction& ins)
+{
+    V[0xF] = V[ins.X] & 0x8000; // TODO: does this store the 1 and 0 as '1' and '0' or as the value?
+    V[ins.X] <<= 1;
+    pc += 2;
+}
+
+void CPU::execRSUB(const Instruction& ins)
+{
+    if (V[ins.Y] > (0xFF - V[ins.X])) // TODO: visit this logic
+        V[0xF] = 0; /* borrow */
+    else
+        V[0xF] = 1;
+    V[ins.X] = V[ins.Y] - V[ins.X];
+    pc += 2;
+}
+
+void CPU::execSHR(const Instruction& ins)
+{
+    V[0xF] = V[ins.X] & 0x1;
+    V[ins.X] >>= 1;
+    pc += 2;
+}
+
+void CPU::execSUB(const Instruction& ins)
+{
+    if (V[ins.Y] > (0xFF - V[ins.X])) // TODO: visit this logic
+        V[0xF] = 0; /* borrow */
+    else
+        V[0xF] = 1;
+    V[ins.X] -= V[ins.Y];
+    pc += 2;
+}
+
+void CPU::execRADD(const Instruction& ins)
+{
+    if (V[ins.Y] > (0xFF - V[ins.X])) // TODO: visit this logic
+        V[0xF] = 1; /* carry */
+    else
+        V[0xF] = 0;
+    V[ins.X] += V[ins.Y];
+    pc += 2;
+}
+
+void CPU::execXOR(const Instruction& ins)
+{
+    V[ins.X] ^= V[ins.Y];
+    pc += 2;
+}
+
+void CPU::execAND(const Instruction& ins)
+{
+    V[ins.X] &= V[ins.Y];
+    pc += 2;
+}
+
+void CPU::execOR(const Instruction& ins)
+{
+    V[ins.X] |= V[ins.Y];
+    pc += 2;
+}
+
+void CPU::execASN(const Instruction& ins)
+{
+    V[ins.X] = V[ins.Y];
+    pc += 2;
+}
+
+void CPU::execADD(const Instruction& ins)
 {
-    /* ADD */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t NN = (op & 0x00FF);
-    V[X] += NN;
+    V[ins.X] += ins.NN;
     pc += 2;
 }
 
-void CPU::process6(uint16_t op)
+void CPU::execLOAD(const Instruction& ins)
 {
-    /* LOAD */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t NN = (op & 0x00FF);
-    V[X] = NN;
+    V[ins.X] = ins.NN;
     pc += 2;
 }
 
-void CPU::process5(uint16_t op)
+void CPU::execSKRE(const Instruction& ins)
 {
-    /* SKRE */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t Y = (op & 0x00F0) >> 4;
-    if (V[X] == V[Y]) {
+    if (V[ins.X] == V[ins.Y]) {
         pc += 4;
     } else {
         pc += 2;
     }
 }
 
-void CPU::process4(uint16_t op)
+void CPU::execSKNE(const Instruction& ins)
 {
-    /* SKNE */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t NN = (op & 0x00FF);
-    if (V[X] != NN) {
+    if (V[ins.X] != ins.NN) {
         pc += 4;
     } else {
         pc += 2;
     }
 }
 
-void CPU::process3(uint16_t op)
+void CPU::execSKE(const Instruction& ins)
 {
-    /* SKE */
-    const uint8_t X = (op & 0x0F00) >> 8;
-    const uint8_t NN = (op & 0x00FF);
-    if (V[X] == NN) {
+    if (V[ins.X] == ins.NN) {
         pc += 4;
     } else {
         pc += 2;
     }
 }
 
-void CPU::process2(uint16_t op)
+void CPU::execCALL(const Instruction& ins)
 {
-    /* CALL */
-    stack[sp++] = pc;
-    pc = op & 0x0FFF;
+    CHIP8_TRACE(CHIP8_TRACE_BRANCH, Call, pc, ins.NNN, (sp + 1) & CHIP8_STACK_MASK);
+    /* The return address is the instruction after the call, RET jumps straight to it */
+    stack[sp] = (pc + 2) & CHIP8_ADDRESS_MASK;
+    sp = (sp + 1) & CHIP8_STACK_MASK;
+    pc = ins.NNN;
 }
 
-void CPU::process1(uint16_t op)
+void CPU::execJMP(const Instruction& ins)
 {
-    /* JMP */
-    const uint16_t dest = (op & 0x0FFF);
-    LOG("Jumping to 0x%04X", dest);
-    pc = dest;
+    CHIP8_TRACE(CHIP8_TRACE_BRANCH, Jump, pc, ins.NNN, 0);
+    pc = ins.NNN;
 }
 
-void CPU::process0(uint16_t op)
+void CPU::execRET(const Instruction&)
 {
-    const auto low = op & 0x0FFF;
-    switch (low) {
-    case 0x00E0:
-        /* CLR */
-        memset(gfx, 0, sizeof(gfx));
-        pc += 2;
-        need_draw = true;
-        break;
-    case 0x00EE:
-        /* RET */
-        pc = stack[--sp];
-        break;
-    default:
-        LOG("process0() 0x%04X is unrecognized.", op);
+    sp = (sp - 1) & CHIP8_STACK_MASK;
+    CHIP8_TRACE(CHIP8_TRACE_BRANCH, Return, pc, stack[sp], sp);
+    pc = stack[sp];
+}
+
+void CPU::execCLR(const Instruction&)
+{
+    CHIP8_TRACE(CHIP8_TRACE_DRAW, Clear, pc, 0, 0);
+    memset(gfx, 0, sizeof(gfx));
+    pc += 2;
+    dirty_rows = CHIP8_ALL_ROWS;
+    if (stopEvents & CHIP8_STOP_DRAW) {
+        stopEvent = CHIP8_STOP_DRAW;
+        suspended = true;
     }
 }
 
 uint16_t CPU::next()
 {
-    return memory[pc] << 8 | memory[pc + 1];
+    return memory[pc & CHIP8_ADDRESS_MASK] << 8 | memory[(pc + 1) & CHIP8_ADDRESS_MASK];
+}
+
+void CPU::setSeed(uint64_t seed)
+{
+    rng = rng_seed(seed);
+}
+
+void CPU::setHost(Host* h)
+{
+    host = h != nullptr ? h : &NULL_HOST;
+}
+
+Host* CPU::getHost() const
+{
+    return host;
+}
+
+void CPU::setKeys(uint16_t k)
+{
+    const uint16_t pressed = k & ~keys;
+    keys = k;
+    if (waiting_for_key && pressed != 0) {
+        /* Hand the lowest key that went down to the FX0A we're stopped on */
+        uint8_t key = 0;
+        while (!(pressed & (1 << key))) {
+            ++key;
+        }
+        CHIP8_TRACE(CHIP8_TRACE_INPUT, KeyPress, pc, key, 0);
+        V[memory[pc & CHIP8_ADDRESS_MASK] & 0xF] = key;
+        pc += 2;
+        waiting_for_key = false;
+    }
+}
+
+bool CPU::isWaitingForKey() const
+{
+    return waiting_for_key;
 }
 
 void CPU::setDraw(bool draw)
 {
-    need_draw = draw;
+    dirty_rows = draw ? CHIP8_ALL_ROWS : 0;
 }
 
 bool CPU::needsDraw() const
 {
-    return need_draw;
+    return dirty_rows != 0;
+}
+
+uint32_t CPU::getDirtyRows() const
+{
+    return dirty_rows;
+}
+
+const uint64_t* CPU::getGFX() const
+{
+    return gfx;
+}
+
+/*
+ * A snapshot is this header followed by the raw CPUState in native byte order.
+ * Bump the version whenever CPUState changes.
+ */
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t stateSize;
+};
+
+static_assert(std::is_trivially_copyable<CPUState>::value, "CPUState must be copyable as raw bytes");
+
+static const char SNAPSHOT_MAGIC[4] = { 'C', '8', 'S', 'S' };
+static const uint32_t SNAPSHOT_VERSION = 4;
+
+size_t CPU::snapshotSize()
+{
+    return sizeof(SnapshotHeader) + sizeof(CPUState);
 }
 
-uint8_t* CPU::getGFX()
+bool CPU::save(uint8_t* buffer, size_t size) const
 {
-    return &gfx[0];
+    if (size < snapshotSize()) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.stateSize = sizeof(CPUState);
+
+    std::memcpy(buffer, &header, sizeof(header));
+    std::memcpy(buffer + sizeof(header), static_cast<const CPUState*>(this), sizeof(CPUState));
+    return true;
+}
+
+bool CPU::load(const uint8_t* buffer, size_t size)
+{
+    if (size < snapshotSize()) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    std::memcpy(&header, buffer, sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.stateSize != sizeof(CPUState)) {
+        return false;
+    }
+
+    const uint8_t* state = buffer + sizeof(header);
+
+    /* Anything out of range here would send the CPU outside of its arrays */
+    uint16_t savedSp, savedPc;
+    uint8_t savedWaiting;
+    uint64_t savedRng;
+    std::memcpy(&savedSp, state + offsetof(CPUState, sp), sizeof(savedSp));
+    std::memcpy(&savedPc, state + offsetof(CPUState, pc), sizeof(savedPc));
+    std::memcpy(&savedWaiting, state + offsetof(CPUState, waiting_for_key), sizeof(savedWaiting));
+    std::memcpy(&savedRng, state + offsetof(CPUState, rng), sizeof(savedRng));
+    if (savedSp >= CHIP8_STACK_DEPTH || savedPc >= CHIP8_MEMORY_SIZE || savedWaiting > 1) {
+        return false;
+    }
+
+    /* xorshift never leaves a state of zero, CXNN would only ever produce 0 */
+    if (savedRng == 0) {
+        return false;
+    }
+
+    /* Only code that actually differs has to be decoded or translated again */
+    const uint8_t* savedMemory = state + offsetof(CPUState, memory);
+    uint32_t a = 0;
+    while (a < CHIP8_MEMORY_SIZE) {
+        if (memory[a] == savedMemory[a]) {
+            ++a;
+            continue;
+        }
+        const uint32_t start = a;
+        while (a < CHIP8_MEMORY_SIZE && memory[a] != savedMemory[a]) {
+            ++a;
+        }
+        invalidate(start, a - start);
+    }
+
+    std::memcpy(static_cast<CPUState*>(this), state, sizeof(CPUState));
+
+    /* The whole screen may look different now */
+    dirty_rows = CHIP8_ALL_ROWS;
+
+    /* Whatever idle loop the CPU was suspended in belongs to the state it had before */
+    suspended = false;
+    idleLoopLength = 0;
+    skippedCycles = 0;
+    return true;
 }
\ No newline at end of file
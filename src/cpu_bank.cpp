@@ -0,0 +1,298 @@
+#include "cpu_bank.h"
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+
+    /* Lanes per 256-bit register */
+    #define BANK_LANES8 (32)
+    #define BANK_LANES16 (16)
+
+    static inline __m256i load8(const uint8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static inline __m256i load16(const uint16_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static inline void store8(uint8_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    static inline void store16(uint16_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+
+    /* Zero extends 16 bytes to 16 words */
+    static inline __m256i widen(const uint8_t* p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+
+    /* 0xFF where x + y overflows a byte */
+    static inline __m256i carries(__m256i x, __m256i y)
+    {
+        const __m256i noCarry = _mm256_cmpeq_epi8(_mm256_adds_epu8(x, y), _mm256_add_epi8(x, y));
+        return _mm256_xor_si256(noCarry, _mm256_set1_epi8(-1));
+    }
+#endif
+
+bool bank_all_equal8(const uint8_t* values, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(values[0]));
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(load8(values + i), first)) != -1) {
+            return false;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (values[i] != values[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool bank_all_equal16(const uint16_t* values, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i first = _mm256_set1_epi16(static_cast<short>(values[0]));
+    for (; i + BANK_LANES16 <= n; i += BANK_LANES16) {
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(load16(values + i), first)) != -1) {
+            return false;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (values[i] != values[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void bank_fill16(uint16_t* values, uint16_t value, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i v = _mm256_set1_epi16(static_cast<short>(value));
+    for (; i + BANK_LANES16 <= n; i += BANK_LANES16) {
+        store16(values + i, v);
+    }
+#endif
+    for (; i < n; ++i) {
+        values[i] = value;
+    }
+}
+
+void bank_advance(uint16_t* pc, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i mask = _mm256_set1_epi16(CHIP8_ADDRESS_MASK);
+    for (; i + BANK_LANES16 <= n; i += BANK_LANES16) {
+        store16(pc + i, _mm256_and_si256(_mm256_add_epi16(load16(pc + i), two), mask));
+    }
+#endif
+    for (; i < n; ++i) {
+        pc[i] = (pc[i] + 2) & CHIP8_ADDRESS_MASK;
+    }
+}
+
+void bank_tick(uint8_t* timers, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi8(1);
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(timers + i, _mm256_subs_epu8(load8(timers + i), one));
+    }
+#endif
+    for (; i < n; ++i) {
+        timers[i] = timers[i] > 0 ? timers[i] - 1 : 0;
+    }
+}
+
+void bank_add_imm(uint8_t* x, uint8_t imm, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i v = _mm256_set1_epi8(static_cast<char>(imm));
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(x + i, _mm256_add_epi8(load8(x + i), v));
+    }
+#endif
+    for (; i < n; ++i) {
+        x[i] += imm;
+    }
+}
+
+void bank_copy(uint8_t* x, const uint8_t* y, size_t n)
+{
+    if (x != y) {
+        std::memcpy(x, y, n);
+    }
+}
+
+void bank_or(uint8_t* x, const uint8_t* y, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(x + i, _mm256_or_si256(load8(x + i), load8(y + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        x[i] |= y[i];
+    }
+}
+
+void bank_and(uint8_t* x, const uint8_t* y, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(x + i, _mm256_and_si256(load8(x + i), load8(y + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        x[i] &= y[i];
+    }
+}
+
+void bank_xor(uint8_t* x, const uint8_t* y, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(x + i, _mm256_xor_si256(load8(x + i), load8(y + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        x[i] ^= y[i];
+    }
+}
+
+/* The arithmetic kernels store VF before reloading the operands in case X or Y is F */
+
+void bank_add_carry(uint8_t* x, const uint8_t* y, uint8_t* vf, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi8(1);
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(vf + i, _mm256_and_si256(carries(load8(x + i), load8(y + i)), one));
+        store8(x + i, _mm256_add_epi8(load8(x + i), load8(y + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        vf[i] = y[i] > 0xFF - x[i] ? 1 : 0;
+        x[i] += y[i];
+    }
+}
+
+void bank_sub_borrow(uint8_t* x, const uint8_t* y, uint8_t* vf, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi8(1);
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(vf + i, _mm256_andnot_si256(carries(load8(x + i), load8(y + i)), one));
+        store8(x + i, _mm256_sub_epi8(load8(x + i), load8(y + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        vf[i] = y[i] > 0xFF - x[i] ? 0 : 1;
+        x[i] -= y[i];
+    }
+}
+
+void bank_rsub_borrow(uint8_t* x, const uint8_t* y, uint8_t* vf, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi8(1);
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(vf + i, _mm256_andnot_si256(carries(load8(x + i), load8(y + i)), one));
+        store8(x + i, _mm256_sub_epi8(load8(y + i), load8(x + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        vf[i] = y[i] > 0xFF - x[i] ? 0 : 1;
+        x[i] = y[i] - x[i];
+    }
+}
+
+void bank_shr(uint8_t* x, uint8_t* vf, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i low7 = _mm256_set1_epi8(0x7F);
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        store8(vf + i, _mm256_and_si256(load8(x + i), one));
+        store8(x + i, _mm256_and_si256(_mm256_srli_epi16(load8(x + i), 1), low7));
+    }
+#endif
+    for (; i < n; ++i) {
+        vf[i] = x[i] & 0x1;
+        x[i] >>= 1;
+    }
+}
+
+void bank_shl(uint8_t* x, uint8_t* vf, size_t n)
+{
+    /* The CPU masks the byte with 0x8000, so VF always ends up 0 */
+    std::memset(vf, 0, n);
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + BANK_LANES8 <= n; i += BANK_LANES8) {
+        const __m256i v = load8(x + i);
+        store8(x + i, _mm256_add_epi8(v, v));
+    }
+#endif
+    for (; i < n; ++i) {
+        x[i] <<= 1;
+    }
+}
+
+void bank_add_index(uint16_t* index, const uint8_t* x, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + BANK_LANES16 <= n; i += BANK_LANES16) {
+        store16(index + i, _mm256_add_epi16(load16(index + i), widen(x + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        index[i] += x[i];
+    }
+}
+
+void bank_skip_imm(uint16_t* pc, const uint8_t* x, uint8_t imm, bool ifEqual, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i mask = _mm256_set1_epi16(CHIP8_ADDRESS_MASK);
+    const __m256i value = _mm256_set1_epi16(imm);
+    const __m256i flip = ifEqual ? _mm256_setzero_si256() : _mm256_set1_epi16(-1);
+    for (; i + BANK_LANES16 <= n; i += BANK_LANES16) {
+        const __m256i skip = _mm256_xor_si256(_mm256_cmpeq_epi16(widen(x + i), value), flip);
+        const __m256i next = _mm256_add_epi16(load16(pc + i), _mm256_add_epi16(two, _mm256_and_si256(skip, two)));
+        store16(pc + i, _mm256_and_si256(next, mask));
+    }
+#endif
+    for (; i < n; ++i) {
+        pc[i] = (pc[i] + ((x[i] == imm) == ifEqual ? 4 : 2)) & CHIP8_ADDRESS_MASK;
+    }
+}
+
+void bank_skip_reg(uint16_t* pc, const uint8_t* x, const uint8_t* y, bool ifEqual, size_t n)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i mask = _mm256_set1_epi16(CHIP8_ADDRESS_MASK);
+    const __m256i flip = ifEqual ? _mm256_setzero_si256() : _mm256_set1_epi16(-1);
+    for (; i + BANK_LANES16 <= n; i += BANK_LANES16) {
+        const __m256i skip = _mm256_xor_si256(_mm256_cmpeq_epi16(widen(x + i), widen(y + i)), flip);
+        const __m256i next = _mm256_add_epi16(load16(pc + i), _mm256_add_epi16(two, _mm256_and_si256(skip, two)));
+        store16(pc + i, _mm256_and_si256(next, mask));
+    }
+#endif
+    for (; i < n; ++i) {
+        pc[i] = (pc[i] + ((x[i] == y[i]) == ifEqual ? 4 : 2)) & CHIP8_ADDRESS_MASK;
+    }
+}
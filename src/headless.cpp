@@ -0,0 +1,39 @@
+#include "headless.h"
+#include "cpu.h"
+
+HeadlessResult run_headless(CPU& cpu, Host& host, uint64_t cycles, uint32_t instructionsPerFrame)
+{
+    HeadlessResult result = { 0, 0, 0, 0 };
+    const uint64_t idleBefore = cpu.idleCycles();
+
+    /* Nothing presses keys here, so once FX0A starts waiting the run is over */
+    while (result.cycles < cycles && !cpu.isWaitingForKey()) {
+        const uint64_t remaining = cycles - result.cycles;
+        if (remaining >= instructionsPerFrame) {
+            result.cycles += cpu.runFrame(instructionsPerFrame);
+        } else {
+            /* A partial frame at the end doesn't get a timer tick */
+            result.cycles += cpu.run(static_cast<uint32_t>(remaining));
+        }
+        if (cpu.needsDraw()) {
+            host.present(cpu.getGFX(), cpu.getDirtyRows());
+            cpu.setDraw(false);
+            ++result.frames;
+        }
+    }
+    result.idleCycles = cpu.idleCycles() - idleBefore;
+    result.framebufferHash = hash_framebuffer(cpu.getGFX());
+    return result;
+}
+
+uint64_t hash_framebuffer(const uint64_t* gfx)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int r = 0; r < CHIP8_PIXELS_HEIGHT; ++r) {
+        for (int b = 0; b < 64; b += 8) {
+            hash ^= (gfx[r] >> b) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,82 @@
+#include "instruction.h"
+
+static Op decode_op(uint16_t opcode)
+{
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        switch (opcode & 0x0FFF) {
+        case 0x00E0: return Op::CLR;
+        case 0x00EE: return Op::RET;
+        default:     return Op::INVALID;
+        }
+    case 0x1000: return Op::JMP;
+    case 0x2000: return Op::CALL;
+    case 0x3000: return Op::SKE;
+    case 0x4000: return Op::SKNE;
+    case 0x5000: return Op::SKRE;
+    case 0x6000: return Op::LOAD;
+    case 0x7000: return Op::ADD;
+    case 0x8000:
+        switch (opcode & 0x000F) {
+        case 0x0000: return Op::ASN;
+        case 0x0001: return Op::OR;
+        case 0x0002: return Op::AND;
+        case 0x0003: return Op::XOR;
+        case 0x0004: return Op::RADD;
+        case 0x0005: return Op::SUB;
+        case 0x0006: return Op::SHR;
+        case 0x0007: return Op::RSUB;
+        case 0x000E: return Op::SHL;
+        default:     return Op::INVALID;
+        }
+    case 0x9000: return Op::SKRNE;
+    case 0xA000: return Op::ILOAD;
+    case 0xB000: return Op::ZJMP;
+    case 0xC000: return Op::RAND;
+    case 0xD000: return Op::DRAW;
+    case 0xE000:
+        switch (opcode & 0x00FF) {
+        case 0x009E: return Op::SKK;
+        case 0x00A1: return Op::SKNK;
+        default:     return Op::INVALID;
+        }
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+        case 0x0007: return Op::DELA;
+        case 0x000A: return Op::KEYW;
+        case 0x0015: return Op::DELR;
+        case 0x0018: return Op::SNDR;
+        case 0x001E: return Op::IADD;
+        case 0x0029: return Op::SILS;
+        case 0x0033: return Op::BCD;
+        case 0x0055: return Op::DUMP;
+        case 0x0065: return Op::IDUMP;
+        default:     return Op::INVALID;
+        }
+    default:
+        return Op::INVALID;
+    }
+}
+
+Instruction decode_instruction(uint16_t opcode)
+{
+    Instruction ins;
+    ins.op = decode_op(opcode);
+    ins.X = (opcode & 0x0F00) >> 8;
+    ins.Y = (opcode & 0x00F0) >> 4;
+    ins.N = (opcode & 0x000F);
+    ins.NN = (opcode & 0x00FF);
+    ins.NNN = (opcode & 0x0FFF);
+    return ins;
+}
+
+const char* op_name(Op op)
+{
+    switch (op) {
+#define CHIP8_OP_NAME(name) case Op::name: return #name;
+    CHIP8_INSTRUCTIONS(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+    case Op::DECODE: return "DECODE";
+    default:         return "?";
+    }
+}
@@ -0,0 +1,889 @@
+#include "jit.h"
+#include "cpu.h"
+#include "trace.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__FreeBSD__))
+    #include <sys/mman.h>
+    #define CHIP8_HAS_JIT 1
+#else
+    #define CHIP8_HAS_JIT 0
+#endif
+
+/* Upper bound on the instructions in one block, which also bounds how far back invalidation looks */
+static const uint32_t MAX_BLOCK_INSTRUCTIONS = 32;
+static const uint32_t MAX_BLOCK_BYTES = MAX_BLOCK_INSTRUCTIONS * 2;
+
+/* A block stops taking instructions once its code reaches this size, which leaves room for the longest one */
+static const size_t MAX_BLOCK_BODY = 4096;
+/* Room a block needs in the cache, including the exits at its end */
+static const size_t MAX_BLOCK_CODE = 2 * MAX_BLOCK_BODY;
+
+/* Size of the executable code cache. It is flushed wholesale once it fills up. */
+static const size_t CODE_CACHE_SIZE = 1 << 20;
+
+#if CHIP8_HAS_JIT
+/*
+ * uint32_t enter(CPU* cpu, uint32_t cycles, const uint8_t* code) runs the block at 'code' and
+ * returns the cycles left over. Blocks keep the CPU in rbx and the cycles left in ebp, and
+ * jump to EXIT_OFFSET to return.
+ */
+static const uint8_t ENTRY_CODE[] = {
+    0x53,             /* push rbx */
+    0x55,             /* push rbp */
+    0x50,             /* push rax, keeps the stack aligned for the handlers blocks call */
+    0x48, 0x89, 0xFB, /* mov rbx, rdi */
+    0x89, 0xF5,       /* mov ebp, esi */
+    0xFF, 0xE2,       /* jmp rdx */
+    0x89, 0xE8,       /* mov eax, ebp */
+    0x59,             /* pop rcx */
+    0x5D,             /* pop rbp */
+    0x5B,             /* pop rbx */
+    0xC3              /* ret */
+};
+static const size_t EXIT_OFFSET = 10;
+#else
+static const uint8_t ENTRY_CODE[1] = {};
+#endif
+
+using Enter = uint32_t (*)(CPU* cpu, uint32_t cycles, const uint8_t* code);
+
+Jit::Jit() : drops(0), cache(nullptr), cacheUsed(0), cacheWritable(false)
+{
+#if CHIP8_HAS_JIT
+    void* mem = mmap(nullptr, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        cache = static_cast<uint8_t*>(mem);
+        cacheWritable = true;
+        std::memcpy(cache, ENTRY_CODE, sizeof(ENTRY_CODE));
+    } else {
+        LOG("Couldn't map %zu bytes for the code cache!", CODE_CACHE_SIZE);
+    }
+#endif
+    flush();
+}
+
+Jit::~Jit()
+{
+    release();
+}
+
+bool Jit::available()
+{
+    return CHIP8_HAS_JIT;
+}
+
+bool Jit::usable() const
+{
+    return cache != nullptr;
+}
+
+bool Jit::makeWritable()
+{
+#if CHIP8_HAS_JIT
+    if (!cacheWritable) {
+        if (mprotect(cache, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+            LOG("Couldn't make the code cache writable!");
+            release();
+            return false;
+        }
+        cacheWritable = true;
+    }
+#endif
+    return cache != nullptr;
+}
+
+bool Jit::makeExecutable()
+{
+#if CHIP8_HAS_JIT
+    if (cacheWritable) {
+        /* Hardened kernels may refuse to make memory that was writable executable */
+        if (mprotect(cache, CODE_CACHE_SIZE, PROT_READ | PROT_EXEC) != 0) {
+            LOG("Couldn't make the code cache executable!");
+            release();
+            return false;
+        }
+        cacheWritable = false;
+    }
+#endif
+    return cache != nullptr;
+}
+
+/* Gives the cache back and forgets every block, from then on nothing is translated */
+void Jit::release()
+{
+#if CHIP8_HAS_JIT
+    if (cache != nullptr) {
+        munmap(cache, CODE_CACHE_SIZE);
+        cache = nullptr;
+        cacheWritable = false;
+        flush();
+    }
+#endif
+}
+
+/* Forgets every block, their code stays in the cache until it is flushed */
+void Jit::drop()
+{
+    std::memset(blocks, 0, sizeof(blocks));
+    std::memset(translated, 0, sizeof(translated));
+    links.clear();
+    ++drops;
+}
+
+void Jit::flush()
+{
+    drop();
+    cacheUsed = cache != nullptr ? sizeof(ENTRY_CODE) : 0;
+}
+
+uint32_t Jit::run(CPU& cpu, uint32_t cycles)
+{
+    /* Blocks don't look for runUntil()'s address, so while one is armed they run an instruction at a time */
+    const bool step = cpu.stopPc != CPU::NO_STOP_PC;
+
+    uint32_t executed = 0;
+    while (executed < cycles) {
+        const uint8_t* code = lookup(cpu);
+        /* If the cache can't be made executable it is released and the instruction interpreted */
+        if (code != nullptr && makeExecutable()) {
+            const uint32_t budget = step ? 1 : cycles - executed;
+            executed += budget - reinterpret_cast<Enter>(cache)(&cpu, budget, code);
+        } else {
+            cpu.execute(cpu.fetch());
+            ++executed;
+        }
+        if (cpu.suspended) {
+            break;
+        }
+        if (cpu.pc == cpu.stopPc) {
+            cpu.stopEvent = CHIP8_STOP_PC;
+            break;
+        }
+    }
+    return executed;
+}
+
+const uint8_t* Jit::lookup(CPU& cpu)
+{
+    const uint16_t pc = cpu.pc & CHIP8_ADDRESS_MASK;
+    if (!blocks[pc].compiled) {
+        compile(cpu, pc);
+    }
+    return blocks[pc].code;
+}
+
+void Jit::invalidate(uint16_t address, uint16_t length)
+{
+    if (address >= CHIP8_MEMORY_SIZE) {
+        return;
+    }
+    const uint32_t end = std::min<uint32_t>(static_cast<uint32_t>(address) + length, CHIP8_MEMORY_SIZE);
+    if (std::memchr(translated + address, 1, end - address) == nullptr) {
+        return;
+    }
+
+    const uint32_t first = address > MAX_BLOCK_BYTES ? address - MAX_BLOCK_BYTES : 0;
+    for (uint32_t s = first; s < end; ++s) {
+        if (blocks[s].compiled && blocks[s].end > address) {
+            if (blocks[s].code != nullptr) {
+                /* Other blocks may jump straight into this one, so none of them can be trusted any more */
+                drop();
+                return;
+            }
+            blocks[s] = Block();
+        }
+    }
+}
+
+uint32_t Jit::interpret(CPU* cpu, uint64_t packed)
+{
+    Instruction ins;
+    std::memcpy(&ins, &packed, sizeof(ins));
+    cpu->execute(ins);
+    return cpu->suspended;
+}
+
+uint32_t Jit::written(CPU* cpu, uint64_t length)
+{
+    const uint32_t before = cpu->jit->drops;
+    cpu->invalidate(cpu->index, static_cast<uint16_t>(length));
+    return cpu->jit->drops != before;
+}
+
+uint32_t Jit::checkIdleLoop(CPU* cpu)
+{
+    cpu->checkIdleLoop();
+    return cpu->suspended;
+}
+
+#if CHIP8_HAS_JIT
+
+static_assert(sizeof(Instruction) == sizeof(uint64_t), "Translated code passes instructions to Jit::interpret() in a register");
+static_assert(sizeof(bool) == 1, "Translated code stores to CPU::suspended as a byte");
+
+namespace {
+
+/* The registers we use. Blocks keep the CPU in RBX and the cycles left in EBP. */
+enum Reg : uint8_t {
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+    AH = 4, /* Only in byte instructions, which never get a REX prefix here */
+    ESI = 6
+};
+
+/* Condition codes of the jumps */
+enum Cond : uint8_t {
+    JC = 0x82,
+    JNC = 0x83,
+    JZ = 0x84,
+    JNZ = 0x85
+};
+
+/* A tiny x86-64 assembler for the handful of instructions the blocks need, writing code meant to run at 'base' */
+class Emitter {
+public:
+    explicit Emitter(const uint8_t* base) : base(base) {}
+
+    const uint8_t* data() const { return buf.data(); }
+    size_t length() const { return buf.size(); }
+
+    /* movzx reg, byte/word [rbx + disp] */
+    void loadByte(Reg reg, int32_t disp) { op(0x0F); op(0xB6); mem(reg, disp); }
+    void loadWord(Reg reg, int32_t disp) { op(0x0F); op(0xB7); mem(reg, disp); }
+
+    /* movzx reg, byte [rbx + index + disp] */
+    void loadByteIndexed(Reg reg, Reg index, int32_t disp) { op(0x0F); op(0xB6); mem(reg, index, 0, disp); }
+
+    /* movzx reg, word [rbx + index * 2 + disp] */
+    void loadWordIndexed(Reg reg, Reg index, int32_t disp) { op(0x0F); op(0xB7); mem(reg, index, 1, disp); }
+
+    /* mov byte/word [rbx + disp], reg */
+    void storeByte(int32_t disp, Reg reg) { op(0x88); mem(reg, disp); }
+    void storeWord(int32_t disp, Reg reg) { op(0x66); op(0x89); mem(reg, disp); }
+
+    /* mov byte [rbx + index + disp], reg */
+    void storeByteIndexed(Reg index, int32_t disp, Reg reg) { op(0x88); mem(reg, index, 0, disp); }
+
+    /* mov byte/word/dword [rbx + disp], imm */
+    void storeByteImm(int32_t disp, uint8_t imm) { op(0xC6); mem(EAX, disp); op(imm); }
+    void storeWordImm(int32_t disp, uint16_t imm) { op(0x66); op(0xC7); mem(EAX, disp); word(imm); }
+    void storeDwordImm(int32_t disp, uint32_t imm) { op(0xC7); mem(EAX, disp); dword(imm); }
+
+    /* mov rax, qword [rbx + disp] and back */
+    void loadRax(int32_t disp) { op(0x48); op(0x8B); mem(EAX, disp); }
+    void storeRax(int32_t disp) { op(0x48); op(0x89); mem(EAX, disp); }
+
+    /* test dword [rbx + disp], imm */
+    void testDwordImm(int32_t disp, uint32_t imm) { op(0xF7); mem(EAX, disp); dword(imm); }
+
+    /* mov word [rbx + index * 2 + disp], imm16 */
+    void storeWordImmIndexed(Reg index, int32_t disp, uint16_t imm) { op(0x66); op(0xC7); mem(EAX, index, 1, disp); word(imm); }
+
+    /* add byte [rbx + disp], imm8 */
+    void addByteImm(int32_t disp, uint8_t imm) { op(0x80); mem(EAX, disp); op(imm); }
+
+    /* add word [rbx + disp], ax */
+    void addWordAx(int32_t disp) { op(0x66); op(0x01); mem(EAX, disp); }
+
+    /* <op> al, byte [rbx + disp] */
+    void orAl(int32_t disp) { op(0x0A); mem(EAX, disp); }
+    void andAl(int32_t disp) { op(0x22); mem(EAX, disp); }
+    void xorAl(int32_t disp) { op(0x32); mem(EAX, disp); }
+    void addAl(int32_t disp) { op(0x02); mem(EAX, disp); }
+    void subAl(int32_t disp) { op(0x2A); mem(EAX, disp); }
+    void cmpAl(int32_t disp) { op(0x3A); mem(EAX, disp); }
+
+    void cmpAlImm(uint8_t imm) { op(0x3C); op(imm); }
+    void andAlImm(uint8_t imm) { op(0x24); op(imm); }
+    void shrAl() { op(0xD0); op(0xE8); }
+    void shlAl() { op(0x00); op(0xC0); } /* add al, al */
+
+    void setcDl() { op(0x0F); op(0x92); op(0xC2); }
+    void btEcxEax() { op(0x0F); op(0xA3); op(0xC1); } /* CF = bit eax of ecx */
+    void setncDl() { op(0x0F); op(0x93); op(0xC2); }
+
+    void incEax() { op(0xFF); op(0xC0); }
+    void decEax() { op(0xFF); op(0xC8); }
+    void addEaxImm(uint32_t imm) { op(0x05); dword(imm); }
+    void andEaxImm(uint32_t imm) { op(0x25); dword(imm); }
+    void andEcxImm(uint32_t imm) { op(0x81); op(0xE1); dword(imm); }
+    void timesFiveEax() { op(0x8D); op(0x04); op(0x80); }                 /* lea eax, [rax + rax * 4] */
+    void leaEcx(Reg base, uint8_t imm) { op(0x8D); op(0x48 | base); op(imm); } /* lea ecx, [base + imm8] */
+
+    /* dst = src / 10 for src up to 1028, without a div */
+    void divideByTen(Reg dst, Reg src)
+    {
+        op(0x69); op(0xC0 | dst << 3 | src); dword(205); /* imul dst, src, 205 */
+        op(0xC1); op(0xE8 | dst); op(11);                /* shr dst, 11 */
+    }
+
+    /* dst -= src * 10, through 'scratch' */
+    void subtractTimesTen(Reg dst, Reg src, Reg scratch)
+    {
+        op(0x8D); op(0x04 | scratch << 3); op(0x80 | src << 3 | src); /* lea scratch, [src + src * 4] */
+        op(0x01); op(0xC0 | scratch << 3 | scratch);                  /* add scratch, scratch */
+        op(0x29); op(0xC0 | scratch << 3 | dst);                      /* sub dst, scratch */
+    }
+
+    void movAhCl() { op(0x88); op(0xCC); }
+
+    /* rax ^= rax << n or rax >> n, through rcx */
+    void xorShiftRax(bool left, uint8_t n)
+    {
+        op(0x48); op(0x89); op(0xC1);                 /* mov rcx, rax */
+        op(0x48); op(0xC1); op(left ? 0xE1 : 0xE9); op(n); /* shl/shr rcx, n */
+        op(0x48); op(0x31); op(0xC8);                 /* xor rax, rcx */
+    }
+
+    /* rax = (rax * imm) >> n */
+    void mulShiftRax(uint64_t imm, uint8_t n)
+    {
+        op(0x48); op(0xB9); qword(imm);       /* mov rcx, imm64 */
+        op(0x48); op(0x0F); op(0xAF); op(0xC1); /* imul rax, rcx */
+        op(0x48); op(0xC1); op(0xE8); op(n);  /* shr rax, n */
+    }
+
+    /* Counts one instruction off the cycles left, setting ZF once they're used up */
+    void countDown() { op(0xFF); op(0xCD); } /* dec ebp */
+
+    /* eax = handler(rbx, imm) */
+    void call(uintptr_t handler, uint64_t imm)
+    {
+        op(0x48); op(0xBE); qword(imm); /* mov rsi, imm64 */
+        call(handler);
+    }
+
+    /* eax = handler(rbx) */
+    void call(uintptr_t handler)
+    {
+        op(0x48); op(0x89); op(0xDF); /* mov rdi, rbx */
+        op(0x48); op(0xB8); qword(handler); /* mov rax, imm64 */
+        op(0xFF); op(0xD0); /* call rax */
+    }
+
+    void testEax() { op(0x85); op(0xC0); }
+
+    /* rax = *entry */
+    void loadEntry(const void* entry)
+    {
+        op(0x48); op(0xB8); qword(reinterpret_cast<uintptr_t>(entry)); /* mov rax, imm64 */
+        op(0x48); op(0x8B); op(0x00); /* mov rax, [rax] */
+    }
+
+    /* rax = the first 8 bytes of the 16 byte entry eax of 'table' */
+    void loadEntryIndexed(const void* table)
+    {
+        op(0xC1); op(0xE0); op(0x04); /* shl eax, 4 */
+        op(0x48); op(0xB9); qword(reinterpret_cast<uintptr_t>(table)); /* mov rcx, imm64 */
+        op(0x48); op(0x8B); op(0x04); op(0x01); /* mov rax, [rcx + rax] */
+    }
+
+    void testRax() { op(0x48); op(0x85); op(0xC0); }
+    void jmpRax() { op(0xFF); op(0xE0); }
+
+    /* Jumps to code that's already in place */
+    void jmp(const uint8_t* target) { op(0xE9); rel(target); }
+    void jcc(Cond cond, const uint8_t* target) { op(0x0F); op(cond); rel(target); }
+
+    /* A jump to a place that's emitted later, see bind() */
+    size_t jccForward(Cond cond) { op(0x0F); op(cond); dword(0); return buf.size() - 4; }
+    size_t jmpForward() { op(0xE9); dword(0); return buf.size() - 4; }
+
+    /* Points the jump returned by jccForward() here */
+    void bind(size_t at)
+    {
+        const int32_t distance = static_cast<int32_t>(buf.size() - (at + 4));
+        std::memcpy(&buf[at], &distance, sizeof(distance));
+    }
+
+private:
+    std::vector<uint8_t> buf;
+    const uint8_t* base;
+
+    void op(uint8_t b) { buf.push_back(b); }
+    void word(uint16_t w) { op(w & 0xFF); op(w >> 8); }
+    void dword(uint32_t d) { word(d & 0xFFFF); word(d >> 16); }
+    void qword(uint64_t q) { dword(q & 0xFFFFFFFF); dword(q >> 32); }
+
+    void rel(const uint8_t* target)
+    {
+        dword(static_cast<uint32_t>(target - (base + buf.size() + 4)));
+    }
+
+    /* ModRM + disp32 addressing [rbx + disp] */
+    void mem(Reg reg, int32_t disp) { op(0x83 | (reg << 3)); dword(static_cast<uint32_t>(disp)); }
+
+    /* ModRM + SIB + disp32 addressing [rbx + index * (1 << scale) + disp] */
+    void mem(Reg reg, Reg index, uint8_t scale, int32_t disp)
+    {
+        op(0x84 | (reg << 3));
+        op(static_cast<uint8_t>(scale << 6 | index << 3 | 0x03));
+        dword(static_cast<uint32_t>(disp));
+    }
+};
+
+int32_t offset_of(const CPU& cpu, const void* member)
+{
+    return static_cast<int32_t>(static_cast<const uint8_t*>(member) - reinterpret_cast<const uint8_t*>(&cpu));
+}
+
+/* Whether an instruction can be part of a block, the rest are always interpreted */
+bool is_translated(Op op)
+{
+    return op != Op::KEYW && op != Op::INVALID;
+}
+
+uint64_t pack(const Instruction& ins)
+{
+    uint64_t packed;
+    std::memcpy(&packed, &ins, sizeof(packed));
+    return packed;
+}
+
+} // namespace
+
+void Jit::compile(CPU& cpu, uint16_t start)
+{
+    static_assert(sizeof(Block) == 16 && offsetof(Block, code) == 0, "Translated code looks blocks up as 16 byte entries");
+
+    if (cache != nullptr && cacheUsed + MAX_BLOCK_CODE > CODE_CACHE_SIZE) {
+        flush();
+    }
+
+    /* Even an address we can't translate has to be looked at again once its bytes change */
+    blocks[start] = Block();
+    blocks[start].compiled = true;
+    blocks[start].end = start + 2;
+    std::memset(translated + start, 1, start + 1u < CHIP8_MEMORY_SIZE ? 2 : 1);
+
+    if (cache == nullptr || start + 1u >= CHIP8_MEMORY_SIZE ||
+        !is_translated(decode_instruction(cpu.memory[start] << 8 | cpu.memory[start + 1]).op)) {
+        return;
+    }
+    if (!makeWritable()) {
+        return;
+    }
+
+    const int32_t pcOffset = offset_of(cpu, &cpu.pc);
+    const int32_t indexOffset = offset_of(cpu, &cpu.index);
+    const int32_t spOffset = offset_of(cpu, &cpu.sp);
+    const int32_t stackOffset = offset_of(cpu, &cpu.stack[0]);
+    const int32_t memoryOffset = offset_of(cpu, &cpu.memory[0]);
+    const int32_t delayOffset = offset_of(cpu, &cpu.delay_timer);
+    const int32_t soundOffset = offset_of(cpu, &cpu.sound_timer);
+    const int32_t keysOffset = offset_of(cpu, &cpu.keys);
+    const int32_t rngOffset = offset_of(cpu, &cpu.rng);
+    const int32_t suspendedOffset = offset_of(cpu, &cpu.suspended);
+    const int32_t stopEventsOffset = offset_of(cpu, &cpu.stopEvents);
+    const int32_t stopEventOffset = offset_of(cpu, &cpu.stopEvent);
+    const int32_t vOffset = offset_of(cpu, &cpu.V[0]);
+    const int32_t vf = vOffset + 0xF;
+
+    /* With branches traced, JMP, CALL and RET go through the handlers that trace them */
+    const bool traceBranches = (CHIP8_TRACE_CATEGORIES & CHIP8_TRACE_BRANCH) != 0;
+
+    uint8_t* const code = cache + cacheUsed;
+    const uint8_t* const exit = cache + EXIT_OFFSET;
+    Emitter e(code);
+
+    /* Jumps out of the block that have to leave the pc at an address first, emitted after the body */
+    struct Exit {
+        size_t at;
+        uint16_t pc;
+        bool uncounted; /* Taken before the instruction was counted */
+    };
+    std::vector<Exit> exits;
+    std::vector<Link> newLinks;
+
+    /* Counts the instruction just emitted, leaving with the pc at 'next' once the cycles are used up */
+    auto countDown = [&](uint16_t next) {
+        e.countDown();
+        exits.push_back({ e.jccForward(JZ), next, false });
+    };
+
+    /* Counts the instruction just emitted and carries on at the block at 'target' */
+    auto chain = [&](uint16_t target) {
+        countDown(target);
+        const uint16_t at = target & CHIP8_ADDRESS_MASK;
+        if (at == start) {
+            e.jmp(code);
+        } else if (blocks[at].code != nullptr) {
+            e.jmp(blocks[at].code);
+        } else {
+            if (!blocks[at].compiled) {
+                newLinks.push_back({ at, e.length() });
+            }
+            e.loadEntry(&blocks[at].code);
+            e.testRax();
+            exits.push_back({ e.jccForward(JZ), target, false });
+            e.jmpRax();
+        }
+    };
+
+    /* Counts the instruction just emitted and carries on at the block at the pc it left in the CPU */
+    auto chainDynamic = [&](bool mayBeSuspended) {
+        e.countDown();
+        e.jcc(JZ, exit);
+        if (mayBeSuspended) {
+            e.testEax();
+            e.jcc(JNZ, exit);
+        }
+        e.loadWord(EAX, pcOffset);
+        e.andEaxImm(CHIP8_ADDRESS_MASK);
+        e.loadEntryIndexed(blocks);
+        e.testRax();
+        e.jcc(JZ, exit);
+        e.jmpRax();
+    };
+
+    /* Runs the CPU's handler, which moves the pc on itself */
+    auto callHandler = [&](const Instruction& ins, uint16_t at) {
+        e.storeWordImm(pcOffset, at);
+        e.call(reinterpret_cast<uintptr_t>(&Jit::interpret), pack(ins));
+    };
+
+    /* Leaves the block at 'next' if the helper just called returned nonzero */
+    auto exitIfSet = [&](uint16_t next) {
+        e.testEax();
+        exits.push_back({ e.jccForward(JNZ), next, true });
+    };
+
+    /* Has 'store' write byte i to I + i, addressed by ECX, and leaves the block if that overwrote translated code */
+    auto storeMemory = [&](uint8_t length, uint16_t next, auto store) {
+        e.loadWord(ESI, indexOffset);
+        for (uint8_t i = 0; i < length; ++i) {
+            e.leaEcx(ESI, i);
+            e.andEcxImm(CHIP8_ADDRESS_MASK);
+            store(i);
+        }
+        e.call(reinterpret_cast<uintptr_t>(&Jit::written), length);
+        exitIfSet(next);
+    };
+
+    uint32_t count = 0;
+    uint16_t pc = start;
+    for (;;) {
+        const Instruction ins = decode_instruction(cpu.memory[pc] << 8 | cpu.memory[pc + 1]);
+        const int32_t vx = vOffset + ins.X;
+        const int32_t vy = vOffset + ins.Y;
+        const uint16_t next = pc + 2;
+        ++count;
+
+        /* Each case mirrors the matching CPU::exec* handler, including the order of VF updates */
+        bool ends = true;
+        switch (ins.op) {
+        case Op::LOAD:
+            e.storeByteImm(vx, ins.NN);
+            ends = false;
+            break;
+        case Op::ADD:
+            e.addByteImm(vx, ins.NN);
+            ends = false;
+            break;
+        case Op::ASN:
+            e.loadByte(EAX, vy);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::OR:
+            e.loadByte(EAX, vx);
+            e.orAl(vy);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::AND:
+            e.loadByte(EAX, vx);
+            e.andAl(vy);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::XOR:
+            e.loadByte(EAX, vx);
+            e.xorAl(vy);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::RADD:
+            e.loadByte(EAX, vx);
+            e.addAl(vy);
+            e.setcDl();
+            e.storeByte(vf, EDX);
+            e.loadByte(EAX, vx);
+            e.addAl(vy);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::SUB:
+            e.loadByte(EAX, vx);
+            e.addAl(vy);
+            e.setncDl();
+            e.storeByte(vf, EDX);
+            e.loadByte(EAX, vx);
+            e.subAl(vy);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::RSUB:
+            e.loadByte(EAX, vx);
+            e.addAl(vy);
+            e.setncDl();
+            e.storeByte(vf, EDX);
+            e.loadByte(EAX, vy);
+            e.subAl(vx);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::SHR:
+            e.loadByte(EAX, vx);
+            e.andAlImm(0x1);
+            e.storeByte(vf, EAX);
+            e.loadByte(EAX, vx);
+            e.shrAl();
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::SHL:
+            e.storeByteImm(vf, 0);
+            e.loadByte(EAX, vx);
+            e.shlAl();
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::ILOAD:
+            e.storeWordImm(indexOffset, ins.NNN);
+            ends = false;
+            break;
+        case Op::IADD:
+            e.loadByte(EAX, vx);
+            e.addWordAx(indexOffset);
+            ends = false;
+            break;
+        case Op::SILS:
+            e.loadByte(EAX, vx);
+            e.timesFiveEax();
+            e.storeWord(indexOffset, EAX);
+            ends = false;
+            break;
+        case Op::IDUMP:
+            e.loadWord(EAX, indexOffset);
+            for (uint8_t i = 0; i <= ins.X; ++i) {
+                e.leaEcx(EAX, i);
+                e.andEcxImm(CHIP8_ADDRESS_MASK);
+                e.loadByteIndexed(EDX, ECX, memoryOffset);
+                e.storeByte(vOffset + i, EDX);
+            }
+            ends = false;
+            break;
+        case Op::DUMP:
+            storeMemory(ins.X + 1, next, [&](uint8_t i) {
+                e.loadByte(EDX, vOffset + i);
+                e.storeByteIndexed(ECX, memoryOffset, EDX);
+            });
+            ends = false;
+            break;
+        case Op::BCD: {
+            /* Hundreds end up in AH, tens in DL and ones in AL */
+            e.loadByte(EAX, vx);
+            e.divideByTen(EDX, EAX);
+            e.subtractTimesTen(EAX, EDX, ECX);
+            e.divideByTen(ECX, EDX);
+            e.subtractTimesTen(EDX, ECX, ESI);
+            e.movAhCl();
+            const Reg digits[] = { AH, EDX, EAX };
+            storeMemory(3, next, [&](uint8_t i) { e.storeByteIndexed(ECX, memoryOffset, digits[i]); });
+            ends = false;
+            break;
+        }
+        case Op::RAND:
+            /* rng_next_byte() */
+            e.loadRax(rngOffset);
+            e.xorShiftRax(false, 12);
+            e.xorShiftRax(true, 25);
+            e.xorShiftRax(false, 27);
+            e.storeRax(rngOffset);
+            e.mulShiftRax(0x2545F4914F6CDD1DULL, 56);
+            e.andAlImm(ins.NN);
+            e.storeByte(vx, EAX);
+            ends = false;
+            break;
+        case Op::DELA:
+            e.loadByte(EAX, delayOffset);
+            e.storeByte(vx, EAX);
+            e.storeWordImm(pcOffset, next);
+            e.call(reinterpret_cast<uintptr_t>(&Jit::checkIdleLoop));
+            exitIfSet(next);
+            ends = false;
+            break;
+        case Op::DELR:
+            e.loadByte(EAX, vx);
+            e.storeByte(delayOffset, EAX);
+            ends = false;
+            break;
+        case Op::SNDR: {
+            /* Starting the sound stops the run if runUntil() asked for it */
+            e.loadByte(EAX, soundOffset);
+            e.testEax();
+            const size_t playing = e.jccForward(JNZ);
+            e.loadByte(EAX, vx);
+            e.testEax();
+            const size_t silent = e.jccForward(JZ);
+            e.testDwordImm(stopEventsOffset, CHIP8_STOP_SOUND);
+            const size_t ignored = e.jccForward(JZ);
+            e.storeDwordImm(stopEventOffset, CHIP8_STOP_SOUND);
+            e.storeByteImm(suspendedOffset, 1);
+            e.storeByte(soundOffset, EAX);
+            exits.push_back({ e.jmpForward(), next, true });
+            e.bind(playing);
+            e.bind(silent);
+            e.bind(ignored);
+            e.loadByte(EAX, vx);
+            e.storeByte(soundOffset, EAX);
+            ends = false;
+            break;
+        }
+        case Op::CLR:
+        case Op::DRAW:
+            /* Both move the pc on to 'next' and may stop the run */
+            callHandler(ins, pc);
+            exitIfSet(next);
+            ends = false;
+            break;
+        case Op::JMP:
+            if (traceBranches) {
+                callHandler(ins, pc);
+                chainDynamic(false);
+            } else {
+                chain(ins.NNN);
+            }
+            break;
+        case Op::CALL:
+            if (traceBranches) {
+                callHandler(ins, pc);
+                chainDynamic(false);
+            } else {
+                e.loadWord(EAX, spOffset);
+                e.storeWordImmIndexed(EAX, stackOffset, next & CHIP8_ADDRESS_MASK);
+                e.incEax();
+                e.andEaxImm(CHIP8_STACK_MASK);
+                e.storeWord(spOffset, EAX);
+                chain(ins.NNN);
+            }
+            break;
+        case Op::RET:
+            if (traceBranches) {
+                callHandler(ins, pc);
+            } else {
+                e.loadWord(EAX, spOffset);
+                e.decEax();
+                e.andEaxImm(CHIP8_STACK_MASK);
+                e.storeWord(spOffset, EAX);
+                e.loadWordIndexed(EAX, EAX, stackOffset);
+                e.storeWord(pcOffset, EAX);
+            }
+            chainDynamic(false);
+            break;
+        case Op::ZJMP:
+            e.loadByte(EAX, vOffset);
+            e.addEaxImm(ins.NNN);
+            e.andEaxImm(CHIP8_ADDRESS_MASK);
+            e.storeWord(pcOffset, EAX);
+            chainDynamic(false);
+            break;
+        case Op::SKE:
+        case Op::SKNE:
+        case Op::SKRE:
+        case Op::SKRNE:
+        case Op::SKK:
+        case Op::SKNK: {
+            e.loadByte(EAX, vx);
+            Cond notTakenIf;
+            if (ins.op == Op::SKK || ins.op == Op::SKNK) {
+                e.andEaxImm(0xF);
+                e.loadWord(ECX, keysOffset);
+                e.btEcxEax();
+                notTakenIf = ins.op == Op::SKK ? JNC : JC;
+            } else {
+                if (ins.op == Op::SKE || ins.op == Op::SKNE) {
+                    e.cmpAlImm(ins.NN);
+                } else {
+                    e.cmpAl(vy);
+                }
+                notTakenIf = ins.op == Op::SKE || ins.op == Op::SKRE ? JNZ : JZ;
+            }
+            const size_t notTaken = e.jccForward(notTakenIf);
+            chain(pc + 4);
+            e.bind(notTaken);
+            chain(next);
+            break;
+        }
+        default:
+            callHandler(ins, pc);
+            chainDynamic(true);
+            break;
+        }
+
+        if (ends) {
+            pc = next;
+            break;
+        }
+        pc = next;
+
+        const bool fits = count < MAX_BLOCK_INSTRUCTIONS && e.length() < MAX_BLOCK_BODY && pc + 1u < CHIP8_MEMORY_SIZE;
+        if (!fits || !is_translated(decode_instruction(cpu.memory[pc] << 8 | cpu.memory[pc + 1]).op)) {
+            chain(pc);
+            break;
+        }
+        countDown(pc);
+    }
+
+    for (const Exit& x : exits) {
+        e.bind(x.at);
+        if (x.uncounted) {
+            e.countDown();
+        }
+        e.storeWordImm(pcOffset, x.pc);
+        e.jmp(exit);
+    }
+
+    if (cacheUsed + e.length() > CODE_CACHE_SIZE) {
+        return;
+    }
+    std::memcpy(code, e.data(), e.length());
+    cacheUsed += e.length();
+
+    blocks[start].code = code;
+    blocks[start].end = pc;
+    std::memset(translated + start, 1, pc - start);
+
+    /* Jumps that were waiting for this block go straight to it from now on */
+    for (size_t i = 0; i < links.size();) {
+        if (links[i].target == start) {
+            Emitter jump(cache + links[i].at);
+            jump.jmp(code);
+            std::memcpy(cache + links[i].at, jump.data(), jump.length());
+            links[i] = links.back();
+            links.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    for (const Link& link : newLinks) {
+        links.push_back({ link.target, static_cast<size_t>(code - cache) + link.at });
+    }
+}
+
+#else
+
+void Jit::compile(CPU&, uint16_t start)
+{
+    Block& block = blocks[start];
+    block = Block();
+    block.compiled = true;
+    block.end = start + 2;
+}
+
+#endif
@@ -1,8 +1,41 @@
 #include <iostream>
+#include <chrono>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <SDL2/SDL.h>
 #include <cstring>
+#include "batch.h"
+#include "frame_queue.h"
 #include "cpu.h"
+#include "headless.h"
+#include "movie.h"
+#include "rewind.h"
+#include "rng.h"
+#include "rom.h"
+#include "scheduler.h"
+#include "sdl_host.h"
+#include "snapshot.h"
+#include "trace.h"
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+
+#ifdef CHIP8EMU_AOT_PROGRAM
+#include "aot.h"
+extern const AotProgram CHIP8_AOT_PROGRAM;
+#endif
+
+/* How long the window thread waits for input before checking for a new frame */
+static const uint32_t PRESENT_POLL_MS = 4;
+
+/* Rewind history: a snapshot every few frames, as deltas in a few MB */
+static const uint32_t REWIND_INTERVAL = 2;
+static const size_t REWIND_BUFFER_SIZE = 4 << 20;
+
+/* How many instructions to run in headless mode when --cycles isn't given */
+static const uint64_t DEFAULT_HEADLESS_CYCLES = 1000000;
 
 static void show_help()
 {
@@ -10,98 +43,466 @@ static void show_help()
     std::cout << "The only required argument is the input .rom file.\n";
     std::cout << "Here are the supported options:\n";
     std::cout << "   --help | -h -- displays this help screen\n";
+    std::cout << "   --engine=<switch|threaded|jit|aot> -- selects the execution engine (default: threaded when available)\n";
+    std::cout << "   --scale <n> -- how many window pixels each emulated pixel covers (default: " << CHIP8_DEFAULT_WINDOW_SCALE << ")\n";
+    std::cout << "   --ipf <n> -- how many instructions to run per 60 Hz frame (default: " << CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME << ")\n";
+    std::cout << "   --turbo -- runs as fast as possible instead of in real time. Tab toggles this while running.\n";
+    std::cout << "   --seed <n> -- seeds the random numbers CXNN produces (default: random in a window, " << CHIP8_DEFAULT_SEED << " otherwise)\n";
+    std::cout << "   --load-state <file> -- restores a snapshot before running\n";
+    std::cout << "   --save-state <file> -- where F5 saves a snapshot (default: <rom>.state) and F9 restores it from. Headless runs save here when they finish.\n";
+    std::cout << "   --record <file> -- records the keys pressed in every frame to a movie file\n";
+    std::cout << "   --play <file> -- plays a recorded movie back without a window, as fast as possible, and prints a summary at the end\n";
+    std::cout << "   --trace <file> -- writes what the CPU did to a trace file on exit, see chip8-trace (needs a build configured with CHIP8EMU_TRACE)\n";
+    std::cout << "   --headless -- runs without a window, keyboard or sound and prints a summary at the end\n";
+    std::cout << "   --cycles <n> -- how many instructions to run in headless mode (default: " << DEFAULT_HEADLESS_CYCLES << ")\n";
+    std::cout << "   --batch <dir|list> -- runs every ROM in a directory or list file headless, in parallel, and prints a report\n";
+    std::cout << "   --jobs <n> -- how many threads --batch uses (default: one per core)\n";
+    std::cout << "   --seeds <n> -- runs every --batch ROM n times, seeded --seed, --seed + 1, ... (default: 1)\n";
+    std::cout << "   --time-limit <ms> -- how long each --batch ROM may run (default: no limit)\n";
+    std::cout << "While running, hold Backspace to rewind.\n";
+#ifdef CHIP8EMU_PROFILE
+    std::cout << "This build profiles the interpreter: the report goes to stderr on exit and whenever F2 is pressed.\n";
+#endif
 }
 
-static ROM read_bin_file(const char* filePath)
+static bool parse_engine(const char* name, Engine& engine)
 {
-    std::FILE* rom = std::fopen(filePath, "rb");
-    if (rom == nullptr) {
-        return nullptr;
+    if (std::strcmp(name, "switch") == 0) {
+        engine = Engine::Switch;
+    } else if (std::strcmp(name, "threaded") == 0) {
+        engine = Engine::Threaded;
+    } else if (std::strcmp(name, "jit") == 0) {
+        engine = Engine::Jit;
+    } else if (std::strcmp(name, "aot") == 0) {
+        engine = Engine::Aot;
+    } else {
+        return false;
     }
+    return true;
+}
 
-    std::fseek(rom, 0, SEEK_END);
-    auto fileSize = std::ftell(rom);
-    std::fseek(rom, 0, SEEK_SET);
+static bool parse_count(const char* text, uint64_t& count)
+{
+    char* end = nullptr;
+    const unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    count = value;
+    return true;
+}
 
-    auto memory = std::make_unique<uint8_t[]>(fileSize);
+/* How the window thread steers the emulation thread */
+struct EmulationControls {
+    std::atomic<bool> running{true};
+    std::atomic<bool> turbo{false};
+    std::atomic<bool> rewinding{false};   /* Backspace is held */
+    std::atomic<bool> saveRequested{false};
+    std::atomic<bool> loadRequested{false};
+    std::atomic<bool> profileRequested{false};
+    std::atomic<uint16_t> keys{0};
+};
 
-    std::fread(memory.get(), sizeof(uint8_t), fileSize, rom);
-    std::fclose(rom);
+/*
+ * Runs 'cpu' one frame at a time on its own thread until told to stop. Frames and beeps go to
+ * 'frames' for the window thread to pick up, so showing them never holds up the emulation.
+ * When 'movie' isn't null the keys of every frame are recorded to it.
+ */
+static void run_emulation(CPU& cpu, FrameQueue& frames, EmulationControls& controls,
+                          uint32_t instructionsPerFrame, Movie* movie, const std::string& statePath)
+{
+    Scheduler scheduler(cpu, frames, instructionsPerFrame);
+    Rewind rewind(REWIND_BUFFER_SIZE, REWIND_INTERVAL);
 
-    return memory;
-}
+    while (controls.running) {
+        if (controls.saveRequested.exchange(false) && !save_state_file(cpu, statePath.c_str())) {
+            std::cerr << "Couldn't save the snapshot '" << statePath << "'!\n";
+        }
+        if (controls.loadRequested.exchange(false) && !load_state_file(cpu, statePath.c_str())) {
+            std::cerr << "Couldn't restore the snapshot '" << statePath << "'!\n";
+        }
+#ifdef CHIP8EMU_PROFILE
+        if (controls.profileRequested.exchange(false)) {
+            print_profile(cpu.getProfile(), stderr);
+        }
+#endif
+        if (controls.turbo != scheduler.isTurbo()) {
+            scheduler.setTurbo(controls.turbo);
+        }
 
+        /* Holding backspace steps back through the rewind history, one snapshot per frame */
+        if (controls.rewinding) {
+            if (rewind.stepBack(cpu)) {
+                frames.present(cpu.getGFX(), cpu.getDirtyRows());
+                cpu.setDraw(false);
+            }
+        } else {
+            const uint16_t keys = controls.keys;
+            if (movie != nullptr) {
+                movie_record(*movie, keys);
+            }
+            cpu.setKeys(keys);
+            scheduler.runFrame();
+            rewind.onFrame(cpu);
+        }
+        scheduler.waitForNextFrame();
+    }
+}
 
-static void draw(SDL_Window *win, const uint8_t *gfx)
+static int run_batch_report(const char* path, const BatchOptions& options)
 {
-    SDL_Surface *surface = SDL_GetWindowSurface(win);
-    SDL_LockSurface(surface);
-    uint32_t *pixels = static_cast<uint32_t*>(surface->pixels);
-    std::memset(pixels, 0, surface->w * surface->h * sizeof(*pixels));
+    const std::vector<std::string> roms = list_batch_roms(path);
+    if (roms.empty()) {
+        std::cerr << "Couldn't find any ROMs in '" << path << "'!\n";
+        return EXIT_FAILURE;
+    }
 
-    for (uint32_t r = 0; r < CHIP8_WINDOW_HEIGHT; ++r) {
-        const auto row = r / CHIP8_WINDOW_SCALAR;
-        for (uint32_t c = 0; c < CHIP8_WINDOW_WIDTH; ++c) {
-            const auto col = c / CHIP8_WINDOW_SCALAR;
-            pixels[c + (r * surface->w)] = gfx[col + (row * CHIP8_PIXELS_WIDTH)] ? 0xFFFFFFFF : 0;
-        }
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<BatchResult> results = run_batch(roms, options);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t totalCycles = 0;
+    bool failed = false;
+    uint64_t totalIdleCycles = 0;
+    std::printf("%-10s %20s %12s %12s %8s %16s %9s  %s\n", "exit", "seed", "cycles", "idle", "frames", "framebuffer", "ms", "rom");
+    for (const BatchResult& result : results) {
+        std::printf("%-10s %20llu %12llu %12llu %8llu %016llx %9.1f  %s\n",
+            batch_exit_name(result.exit),
+            static_cast<unsigned long long>(result.seed),
+            static_cast<unsigned long long>(result.cycles),
+            static_cast<unsigned long long>(result.idleCycles),
+            static_cast<unsigned long long>(result.frames),
+            static_cast<unsigned long long>(result.framebufferHash),
+            result.seconds * 1000.0,
+            result.romPath.c_str());
+        totalCycles += result.cycles;
+        totalIdleCycles += result.idleCycles;
+        failed = failed || result.exit == BatchExit::LoadError || result.exit == BatchExit::Error;
     }
-    SDL_UnlockSurface(surface);
-    SDL_UpdateWindowSurface(win);
-    SDL_Delay(15);
+    std::printf("%zu jobs, %llu cycles (%llu idle) in %.2fs (%.1f MIPS)\n",
+        results.size(), static_cast<unsigned long long>(totalCycles), static_cast<unsigned long long>(totalIdleCycles),
+        seconds, totalCycles / seconds / 1e6);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main(int argc, char **argv)
 {
     try {
-        if (argc < 2) {
+        const char* romPath = nullptr;
+        const char* batchPath = nullptr;
+        bool headless = false;
+        uint64_t cycles = DEFAULT_HEADLESS_CYCLES;
+        uint64_t jobs = 0;
+        uint64_t timeLimitMs = 0;
+        uint64_t scale = CHIP8_DEFAULT_WINDOW_SCALE;
+        uint64_t instructionsPerFrame = CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME;
+        bool turbo = false;
+        bool seeded = false;
+        uint64_t seed = CHIP8_DEFAULT_SEED;
+        uint64_t seeds = 1;
+        const char* loadStatePath = nullptr;
+        const char* saveStatePath = nullptr;
+        const char* recordPath = nullptr;
+        const char* playPath = nullptr;
+        const char* tracePath = nullptr;
+        Engine engine = CPU::hasEngine(Engine::Threaded) ? Engine::Threaded : Engine::Switch;
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+                show_help();
+                return EXIT_SUCCESS;
+            } else if (std::strncmp(argv[i], "--engine=", 9) == 0) {
+                if (!parse_engine(argv[i] + 9, engine)) {
+                    std::cerr << "Unknown engine '" << argv[i] + 9 << "'!\n";
+                    return EXIT_FAILURE;
+                }
+                if (!CPU::hasEngine(engine)) {
+                    std::cerr << "The requested engine isn't available in this build! Falling back to 'switch'.\n";
+                }
+            } else if (std::strcmp(argv[i], "--headless") == 0) {
+                headless = true;
+            } else if (std::strcmp(argv[i], "--cycles") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], cycles)) {
+                    std::cerr << "--cycles expects a number of instructions!\n";
+                    return EXIT_FAILURE;
+                }
+                ++i;
+            } else if (std::strcmp(argv[i], "--scale") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], scale) || scale == 0 || scale > 100) {
+                    std::cerr << "--scale expects a number between 1 and 100!\n";
+                    return EXIT_FAILURE;
+                }
+                ++i;
+            } else if (std::strcmp(argv[i], "--ipf") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], instructionsPerFrame) ||
+                    instructionsPerFrame == 0 || instructionsPerFrame > UINT32_MAX) {
+                    std::cerr << "--ipf expects a positive number of instructions!\n";
+                    return EXIT_FAILURE;
+                }
+                ++i;
+            } else if (std::strcmp(argv[i], "--turbo") == 0) {
+                turbo = true;
+            } else if (std::strcmp(argv[i], "--seed") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], seed)) {
+                    std::cerr << "--seed expects a number!\n";
+                    return EXIT_FAILURE;
+                }
+                seeded = true;
+                ++i;
+            } else if (std::strcmp(argv[i], "--seeds") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], seeds) || seeds == 0 || seeds > UINT32_MAX) {
+                    std::cerr << "--seeds expects a positive number!\n";
+                    return EXIT_FAILURE;
+                }
+                ++i;
+            } else if (std::strcmp(argv[i], "--load-state") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "--load-state expects a file!\n";
+                    return EXIT_FAILURE;
+                }
+                loadStatePath = argv[++i];
+            } else if (std::strcmp(argv[i], "--save-state") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "--save-state expects a file!\n";
+                    return EXIT_FAILURE;
+                }
+                saveStatePath = argv[++i];
+            } else if (std::strcmp(argv[i], "--record") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "--record expects a file!\n";
+                    return EXIT_FAILURE;
+                }
+                recordPath = argv[++i];
+            } else if (std::strcmp(argv[i], "--play") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "--play expects a file!\n";
+                    return EXIT_FAILURE;
+                }
+                playPath = argv[++i];
+            } else if (std::strcmp(argv[i], "--trace") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "--trace expects a file!\n";
+                    return EXIT_FAILURE;
+                }
+                if (!trace_enabled()) {
+                    std::cerr << "This build doesn't trace anything! Configure it with -DCHIP8EMU_TRACE=<categories>.\n";
+                    return EXIT_FAILURE;
+                }
+                tracePath = argv[++i];
+            } else if (std::strcmp(argv[i], "--batch") == 0) {
+                if (i + 1 >= argc) {
+                    std::cerr << "--batch expects a directory or a list of ROMs!\n";
+                    return EXIT_FAILURE;
+                }
+                batchPath = argv[++i];
+            } else if (std::strcmp(argv[i], "--jobs") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], jobs) || jobs > UINT_MAX) {
+                    std::cerr << "--jobs expects a number of threads!\n";
+                    return EXIT_FAILURE;
+                }
+                ++i;
+            } else if (std::strcmp(argv[i], "--time-limit") == 0) {
+                if (i + 1 >= argc || !parse_count(argv[i + 1], timeLimitMs) || timeLimitMs > UINT32_MAX) {
+                    std::cerr << "--time-limit expects a number of milliseconds!\n";
+                    return EXIT_FAILURE;
+                }
+                ++i;
+            } else {
+                romPath = argv[i];
+            }
+        }
+
+        if (batchPath != nullptr) {
+            const BatchOptions options = {
+                engine,
+                cycles,
+                static_cast<uint32_t>(instructionsPerFrame),
+                static_cast<uint32_t>(timeLimitMs),
+                static_cast<unsigned>(jobs),
+                seed,
+                static_cast<uint32_t>(seeds)
+            };
+            const int status = run_batch_report(batchPath, options);
+            /* Workers run many jobs each, so a worker's ring holds the tail of its last few ROMs */
+            if (tracePath != nullptr && !trace_write_file(tracePath)) {
+                std::cerr << "Couldn't save the trace '" << tracePath << "'!\n";
+            }
+            return status;
+        }
+
+        if (romPath == nullptr) {
             show_help();
             return EXIT_FAILURE;
         }
 
-        if (std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0) {
-            show_help();
+        /* Movies always start from the beginning of the ROM */
+        if ((recordPath != nullptr || playPath != nullptr) && loadStatePath != nullptr) {
+            std::cerr << "--load-state can't be combined with --record or --play!\n";
+            return EXIT_FAILURE;
+        }
+
+        RomFile rom;
+        const RomError romError = rom.open(romPath);
+        if (romError != RomError::None) {
+            std::cerr << "Couldn't load the ROM '" << romPath << "': " << rom_error_message(romError) << "!\n";
+            return EXIT_FAILURE;
+        }
+        CPU cpu(rom.data(), rom.size());
+        if (engine == Engine::Aot) {
+#ifdef CHIP8EMU_AOT_PROGRAM
+            if (!cpu.loadProgram(CHIP8_AOT_PROGRAM)) {
+                std::cerr << "The built in program was translated from a different ROM! Falling back to 'switch'.\n";
+            }
+#else
+            std::cerr << "This build has no program translated ahead of time! Falling back to 'switch'.\n";
+#endif
+        }
+        cpu.setEngine(engine);
+#ifdef CHIP8EMU_PROFILE
+        if (engine == Engine::Jit || engine == Engine::Aot) {
+            std::cerr << "Only the switch and threaded engines are profiled!\n";
+        }
+#endif
+
+        /* Headless runs stay reproducible unless asked otherwise, a window gets a different game every time */
+        if (!seeded && !headless) {
+            seed = std::random_device()();
+        }
+        cpu.setSeed(seed);
+
+        if (loadStatePath != nullptr && !load_state_file(cpu, loadStatePath)) {
+            std::cerr << "Couldn't restore the snapshot '" << loadStatePath << "'!\n";
+            return EXIT_FAILURE;
+        }
+
+        if (playPath != nullptr) {
+            Movie movie;
+            if (!load_movie_file(movie, playPath)) {
+                std::cerr << "Couldn't read the movie '" << playPath << "'!\n";
+                return EXIT_FAILURE;
+            }
+            HeadlessHost host;
+            const HeadlessResult result = play_movie(cpu, host, movie);
+            std::cout << "cycles: " << result.cycles << "\n";
+            std::cout << "idle: " << result.idleCycles << "\n";
+            std::cout << "frames: " << movie_frames(movie) << " played, " << result.frames << " drawn\n";
+            std::cout << "beeps: " << host.beeps << "\n";
+            std::cout << "framebuffer: " << std::hex << result.framebufferHash << std::dec << "\n";
+            if (tracePath != nullptr && !trace_write_file(tracePath)) {
+                std::cerr << "Couldn't save the trace '" << tracePath << "'!\n";
+            }
+#ifdef CHIP8EMU_PROFILE
+            print_profile(cpu.getProfile(), stderr);
+#endif
+            if (saveStatePath != nullptr && !save_state_file(cpu, saveStatePath)) {
+                std::cerr << "Couldn't save the snapshot '" << saveStatePath << "'!\n";
+                return EXIT_FAILURE;
+            }
             return EXIT_SUCCESS;
         }
 
-        ROM rom = read_bin_file(argv[1]);
-        CPU cpu(std::move(rom));
+        if (headless) {
+            HeadlessHost host;
+            cpu.setHost(&host);
+            const HeadlessResult result = run_headless(cpu, host, cycles, static_cast<uint32_t>(instructionsPerFrame));
+            std::cout << "cycles: " << result.cycles << "\n";
+            std::cout << "idle: " << result.idleCycles << "\n";
+            std::cout << "frames: " << result.frames << "\n";
+            std::cout << "beeps: " << host.beeps << "\n";
+            std::cout << "framebuffer: " << std::hex << result.framebufferHash << std::dec << "\n";
+            if (cpu.isWaitingForKey()) {
+                std::cout << "stopped early: waiting for a key\n";
+            }
+            if (tracePath != nullptr && !trace_write_file(tracePath)) {
+                std::cerr << "Couldn't save the trace '" << tracePath << "'!\n";
+            }
+#ifdef CHIP8EMU_PROFILE
+            print_profile(cpu.getProfile(), stderr);
+#endif
+            if (saveStatePath != nullptr && !save_state_file(cpu, saveStatePath)) {
+                std::cerr << "Couldn't save the snapshot '" << saveStatePath << "'!\n";
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
 
         if (SDL_Init(SDL_INIT_VIDEO) < 0) {
             std::cerr << "Couldn't initialize SDL! " << SDL_GetError() << "\n";
             return EXIT_FAILURE;
         }
 
-        SDL_Window *win = SDL_CreateWindow(
-            "Chip8 Emulator",
-            SDL_WINDOWPOS_CENTERED,
-            SDL_WINDOWPOS_CENTERED,
-            CHIP8_WINDOW_WIDTH,
-            CHIP8_WINDOW_HEIGHT,
-            0
-        );
+        {
+            SdlHost host(static_cast<int>(scale));
+            if (!host.isOpen()) {
+                std::cerr << "Error creating window! Error: " << SDL_GetError() << "\n";
+                return EXIT_FAILURE;
+            }
+            const std::string statePath = saveStatePath != nullptr ? saveStatePath : std::string(romPath) + ".state";
+
+            /* A movie only holds keys, so restoring snapshots or rewinding would make it unplayable */
+            Movie movie;
+            movie.seed = seed;
+            movie.instructionsPerFrame = static_cast<uint32_t>(instructionsPerFrame);
+            const bool recording = recordPath != nullptr;
 
-        if (!win) {
-            std::cerr << "Error creating window! Error: " << SDL_GetError() << "\n";
-            return EXIT_FAILURE;
-        }
+            /* The CPU belongs to the emulation thread from here on, this thread only talks to the window */
+            FrameQueue frames;
+            cpu.setHost(&frames);
+            EmulationControls controls;
+            controls.turbo = turbo;
+            std::thread emulation(run_emulation, std::ref(cpu), std::ref(frames), std::ref(controls),
+                static_cast<uint32_t>(instructionsPerFrame), recording ? &movie : nullptr, std::cref(statePath));
+
+            uint64_t gfx[CHIP8_PIXELS_HEIGHT] = {};
+            uint32_t dirtyRows = 0;
+            bool isRunning = true;
+            while (isRunning) {
+                /* Sleep until there's input or it's time to look for a new frame */
+                SDL_Event event;
+                bool hasEvent = SDL_WaitEventTimeout(&event, PRESENT_POLL_MS) != 0;
+                while (hasEvent) {
+                    if (host.handleEvent(event)) {
+                        controls.keys = host.keypad();
+                    } else if (event.type == SDL_QUIT) {
+                        isRunning = false;
+                    } else if (event.type == SDL_KEYDOWN && !event.key.repeat) {
+                        if (event.key.keysym.sym == SDLK_TAB) {
+                            controls.turbo = !controls.turbo;
+                        } else if (event.key.keysym.sym == SDLK_F5) {
+                            controls.saveRequested = true;
+                        } else if (event.key.keysym.sym == SDLK_F9 && !recording) {
+                            controls.loadRequested = true;
+                        } else if (event.key.keysym.sym == SDLK_F2) {
+                            controls.profileRequested = true;
+                        }
+                    }
+                    hasEvent = SDL_PollEvent(&event) != 0;
+                }
+                controls.rewinding = SDL_GetKeyboardState(nullptr)[SDL_SCANCODE_BACKSPACE] && !recording;
 
-        bool isRunning = true;
-        while (isRunning) {
-            SDL_Event event;
-            while (SDL_PollEvent(&event)) {
-                if (event.type == SDL_QUIT) {
-                    isRunning = false;
+                for (uint32_t beeps = frames.takeBeeps(); beeps > 0; --beeps) {
+                    host.beep();
+                }
+                if (frames.take(gfx, dirtyRows)) {
+                    host.present(gfx, dirtyRows);
                 }
             }
-            cpu.emulate_cycle();
-            if (cpu.needsDraw()) {
-                draw(win, cpu.getGFX());
-                cpu.setDraw(false);
+
+            controls.running = false;
+            emulation.join();
+            cpu.setHost(nullptr);
+
+            if (recording && !save_movie_file(movie, recordPath)) {
+                std::cerr << "Couldn't save the movie '" << recordPath << "'!\n";
+            }
+            if (tracePath != nullptr && !trace_write_file(tracePath)) {
+                std::cerr << "Couldn't save the trace '" << tracePath << "'!\n";
             }
+#ifdef CHIP8EMU_PROFILE
+            print_profile(cpu.getProfile(), stderr);
+#endif
         }
 
-        SDL_DestroyWindow(win);
         SDL_Quit();
 
     } catch (...) {
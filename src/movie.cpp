@@ -0,0 +1,150 @@
+#include "movie.h"
+#include "cpu.h"
+#include <cstdio>
+#include <cstring>
+
+static const uint8_t MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+static const uint32_t MOVIE_VERSION = 1;
+
+/* Magic, version, seed, instructions per frame and run count */
+static const size_t HEADER_SIZE = 4 + 4 + 8 + 4 + 4;
+
+/* Frame count and key mask */
+static const size_t RUN_SIZE = 4 + 2;
+
+static void put_le(std::vector<uint8_t>& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static uint64_t get_le(const uint8_t*& in, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(*in++) << (8 * i);
+    }
+    return value;
+}
+
+void movie_record(Movie& movie, uint16_t keys)
+{
+    if (!movie.runs.empty() && movie.runs.back().keys == keys && movie.runs.back().frames < UINT32_MAX) {
+        ++movie.runs.back().frames;
+    } else {
+        movie.runs.push_back({ 1, keys });
+    }
+}
+
+uint64_t movie_frames(const Movie& movie)
+{
+    uint64_t frames = 0;
+    for (const MovieRun& run : movie.runs) {
+        frames += run.frames;
+    }
+    return frames;
+}
+
+bool save_movie_file(const Movie& movie, const char* path)
+{
+    std::vector<uint8_t> buffer(MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+    buffer.reserve(HEADER_SIZE + movie.runs.size() * RUN_SIZE);
+    put_le(buffer, MOVIE_VERSION, 4);
+    put_le(buffer, movie.seed, 8);
+    put_le(buffer, movie.instructionsPerFrame, 4);
+    put_le(buffer, movie.runs.size(), 4);
+    for (const MovieRun& run : movie.runs) {
+        put_le(buffer, run.frames, 4);
+        put_le(buffer, run.keys, 2);
+    }
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    const bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    return std::fclose(file) == 0 && written;
+}
+
+bool load_movie_file(Movie& movie, const char* path)
+{
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint8_t header[HEADER_SIZE];
+    if (std::fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        std::fclose(file);
+        return false;
+    }
+
+    const uint8_t* in = header + sizeof(MOVIE_MAGIC);
+    const uint64_t version = get_le(in, 4);
+    Movie loaded;
+    loaded.seed = get_le(in, 8);
+    loaded.instructionsPerFrame = static_cast<uint32_t>(get_le(in, 4));
+    const uint64_t runCount = get_le(in, 4);
+    if (std::memcmp(header, MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0 || version != MOVIE_VERSION ||
+        loaded.instructionsPerFrame == 0) {
+        std::fclose(file);
+        return false;
+    }
+
+    /* The runs must fill the rest of the file exactly, a damaged count mustn't size the buffer */
+    const long runsStart = std::ftell(file);
+    if (runsStart < 0 || std::fseek(file, 0, SEEK_END) != 0) {
+        std::fclose(file);
+        return false;
+    }
+    const long fileSize = std::ftell(file);
+    if (fileSize < runsStart || static_cast<uint64_t>(fileSize - runsStart) != runCount * RUN_SIZE ||
+        std::fseek(file, runsStart, SEEK_SET) != 0) {
+        std::fclose(file);
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(runCount * RUN_SIZE);
+    const size_t read = std::fread(buffer.data(), 1, buffer.size(), file);
+    std::fclose(file);
+    if (read != buffer.size()) {
+        return false;
+    }
+
+    in = buffer.data();
+    loaded.runs.reserve(runCount);
+    for (uint64_t r = 0; r < runCount; ++r) {
+        MovieRun run;
+        run.frames = static_cast<uint32_t>(get_le(in, 4));
+        run.keys = static_cast<uint16_t>(get_le(in, 2));
+        loaded.runs.push_back(run);
+    }
+
+    movie = std::move(loaded);
+    return true;
+}
+
+HeadlessResult play_movie(CPU& cpu, Host& host, const Movie& movie)
+{
+    cpu.setSeed(movie.seed);
+    Host* const previousHost = cpu.getHost();
+    cpu.setHost(&host);
+
+    HeadlessResult result = { 0, 0, 0, 0 };
+    const uint64_t idleBefore = cpu.idleCycles();
+    for (const MovieRun& run : movie.runs) {
+        cpu.setKeys(run.keys);
+        for (uint32_t f = 0; f < run.frames; ++f) {
+            result.cycles += cpu.runFrame(movie.instructionsPerFrame);
+            if (cpu.needsDraw()) {
+                host.present(cpu.getGFX(), cpu.getDirtyRows());
+                cpu.setDraw(false);
+                ++result.frames;
+            }
+        }
+    }
+    result.idleCycles = cpu.idleCycles() - idleBefore;
+    result.framebufferHash = hash_framebuffer(cpu.getGFX());
+    cpu.setHost(previousHost);
+    return result;
+}
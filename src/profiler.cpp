@@ -0,0 +1,55 @@
+#include "profiler.h"
+#include <algorithm>
+#include <vector>
+
+void print_profile(const Profile& profile, std::FILE* out, size_t hotspots)
+{
+    uint64_t totalCount = 0;
+    uint64_t totalNanoseconds = 0;
+    std::vector<size_t> ops;
+    for (size_t o = 0; o < static_cast<size_t>(Op::COUNT); ++o) {
+        totalCount += profile.opCount[o];
+        totalNanoseconds += profile.opNanoseconds[o];
+        if (profile.opCount[o] != 0) {
+            ops.push_back(o);
+        }
+    }
+    if (totalCount == 0) {
+        std::fprintf(out, "profile: no instructions were interpreted\n");
+        return;
+    }
+
+    std::sort(ops.begin(), ops.end(), [&](size_t a, size_t b) {
+        return profile.opNanoseconds[a] > profile.opNanoseconds[b];
+    });
+    std::fprintf(out, "%-8s %14s %7s %14s %7s %9s\n", "op", "count", "%", "ns", "%", "ns/op");
+    for (size_t o : ops) {
+        std::fprintf(out, "%-8s %14llu %6.2f%% %14llu %6.2f%% %9.1f\n",
+            op_name(static_cast<Op>(o)),
+            static_cast<unsigned long long>(profile.opCount[o]),
+            100.0 * profile.opCount[o] / totalCount,
+            static_cast<unsigned long long>(profile.opNanoseconds[o]),
+            totalNanoseconds != 0 ? 100.0 * profile.opNanoseconds[o] / totalNanoseconds : 0.0,
+            static_cast<double>(profile.opNanoseconds[o]) / profile.opCount[o]);
+    }
+    std::fprintf(out, "%-8s %14llu %7s %14llu\n", "total",
+        static_cast<unsigned long long>(totalCount), "", static_cast<unsigned long long>(totalNanoseconds));
+
+    std::vector<uint16_t> addresses;
+    for (uint16_t pc = 0; pc < CHIP8_MEMORY_SIZE; ++pc) {
+        if (profile.pcCount[pc] != 0) {
+            addresses.push_back(pc);
+        }
+    }
+    /* Ties go to the lower address so reports of the same run compare equal */
+    hotspots = std::min(hotspots, addresses.size());
+    std::partial_sort(addresses.begin(), addresses.begin() + hotspots, addresses.end(), [&](uint16_t a, uint16_t b) {
+        return profile.pcCount[a] != profile.pcCount[b] ? profile.pcCount[a] > profile.pcCount[b] : a < b;
+    });
+    std::fprintf(out, "\n%-6s %-8s %14s %7s\n", "pc", "op", "count", "%");
+    for (size_t i = 0; i < hotspots; ++i) {
+        const uint16_t pc = addresses[i];
+        std::fprintf(out, "0x%03X  %-8s %14llu %6.2f%%\n", pc, op_name(profile.pcOp[pc]),
+            static_cast<unsigned long long>(profile.pcCount[pc]), 100.0 * profile.pcCount[pc] / totalCount);
+    }
+}
@@ -0,0 +1,178 @@
+#include "rewind.h"
+#include "cpu.h"
+#include <cstring>
+
+/* Bytes framing each delta in the ring: its length before and after it */
+static const size_t RECORD_OVERHEAD = 2 * sizeof(uint32_t);
+
+static void put_varint(std::vector<uint8_t>& out, size_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static size_t get_varint(const uint8_t*& in)
+{
+    size_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= static_cast<size_t>(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | static_cast<size_t>(*in++) << shift;
+}
+
+/*
+ * Encodes a ^ b as a series of (zero run, literal run, literal bytes) where both runs are
+ * varints. Unchanged bytes XOR to zero so long stretches of them cost a byte or two.
+ */
+static void encode_delta(const uint8_t* a, const uint8_t* b, size_t size, std::vector<uint8_t>& out)
+{
+    out.clear();
+    size_t i = 0;
+    while (i < size) {
+        const size_t zeroStart = i;
+        while (i < size && a[i] == b[i]) {
+            ++i;
+        }
+        const size_t literalStart = i;
+        while (i < size && a[i] != b[i]) {
+            ++i;
+        }
+        put_varint(out, literalStart - zeroStart);
+        put_varint(out, i - literalStart);
+        for (size_t j = literalStart; j < i; ++j) {
+            out.push_back(a[j] ^ b[j]);
+        }
+    }
+}
+
+/* XORs a delta made by encode_delta() into 'data' */
+static void apply_delta(const uint8_t* in, size_t length, uint8_t* data)
+{
+    const uint8_t* end = in + length;
+    size_t i = 0;
+    while (in < end) {
+        i += get_varint(in);
+        size_t literals = get_varint(in);
+        while (literals-- > 0) {
+            data[i++] ^= *in++;
+        }
+    }
+}
+
+Rewind::Rewind(size_t capacity, uint32_t interval)
+    : ring(capacity), head(0), tail(0), used(0), count(0),
+    interval(interval > 0 ? interval : 1), framesSinceSnapshot(0), hasLatest(false), atLatest(false),
+    latest(CPU::snapshotSize()), current(CPU::snapshotSize())
+{
+}
+
+void Rewind::onFrame(const CPU& cpu)
+{
+    if (hasLatest && ++framesSinceSnapshot < interval) {
+        atLatest = false;
+        return;
+    }
+    framesSinceSnapshot = 0;
+
+    cpu.save(current.data(), current.size());
+    if (hasLatest) {
+        encode_delta(current.data(), latest.data(), current.size(), delta);
+        push(delta.data(), static_cast<uint32_t>(delta.size()));
+    }
+    latest.swap(current);
+    hasLatest = true;
+    atLatest = true;
+}
+
+bool Rewind::stepBack(CPU& cpu)
+{
+    /* The newest snapshot is at most 'interval' frames back, that's the first step */
+    if (hasLatest && !atLatest) {
+        if (!cpu.load(latest.data(), latest.size())) {
+            return false;
+        }
+        atLatest = true;
+        framesSinceSnapshot = 0;
+        return true;
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    /* Nothing is popped until the older snapshot has been restored */
+    uint32_t length;
+    read((head + ring.size() - sizeof(length)) % ring.size(), reinterpret_cast<uint8_t*>(&length), sizeof(length));
+    delta.resize(length);
+    read((head + ring.size() - sizeof(length) - length) % ring.size(), delta.data(), length);
+    current = latest;
+    apply_delta(delta.data(), delta.size(), current.data());
+    if (!cpu.load(current.data(), current.size())) {
+        return false;
+    }
+
+    head = (head + ring.size() - length - RECORD_OVERHEAD) % ring.size();
+    used -= length + RECORD_OVERHEAD;
+    --count;
+    latest.swap(current);
+    framesSinceSnapshot = 0;
+    return true;
+}
+
+size_t Rewind::depth() const
+{
+    return count + (hasLatest && !atLatest ? 1 : 0);
+}
+
+size_t Rewind::bytesUsed() const
+{
+    return used;
+}
+
+void Rewind::push(const uint8_t* data, uint32_t length)
+{
+    const size_t needed = length + RECORD_OVERHEAD;
+    if (needed > ring.size()) {
+        /* Every older delta builds on this one so none of them are any use without it */
+        head = tail = used = count = 0;
+        return;
+    }
+
+    while (ring.size() - used < needed) {
+        dropOldest();
+    }
+
+    write(head, reinterpret_cast<const uint8_t*>(&length), sizeof(length));
+    write((head + sizeof(length)) % ring.size(), data, length);
+    write((head + sizeof(length) + length) % ring.size(), reinterpret_cast<const uint8_t*>(&length), sizeof(length));
+    head = (head + needed) % ring.size();
+    used += needed;
+    ++count;
+}
+
+void Rewind::dropOldest()
+{
+    uint32_t length;
+    read(tail, reinterpret_cast<uint8_t*>(&length), sizeof(length));
+    tail = (tail + length + RECORD_OVERHEAD) % ring.size();
+    used -= length + RECORD_OVERHEAD;
+    --count;
+}
+
+void Rewind::write(size_t position, const uint8_t* data, size_t length)
+{
+    const size_t first = length < ring.size() - position ? length : ring.size() - position;
+    std::memcpy(ring.data() + position, data, first);
+    std::memcpy(ring.data(), data + first, length - first);
+}
+
+void Rewind::read(size_t position, uint8_t* data, size_t length) const
+{
+    const size_t first = length < ring.size() - position ? length : ring.size() - position;
+    std::memcpy(data, ring.data() + position, first);
+    std::memcpy(data + first, ring.data(), length - first);
+}
@@ -0,0 +1,115 @@
+#include "rom.h"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/*
+ * ROMs are read rather than mapped. Mapping would save a copy, but for files this small the
+ * page fault and unmapping cost more than reading them outright.
+ */
+
+const char* rom_error_message(RomError error)
+{
+    switch (error) {
+    case RomError::None:     return "no error";
+    case RomError::Open:     return "the file can't be opened";
+    case RomError::NotAFile: return "it isn't a regular file";
+    case RomError::Empty:    return "the file is empty";
+    case RomError::TooLarge: return "the file doesn't fit in memory";
+    case RomError::Read:     return "the file can't be read";
+    }
+    return "unknown error";
+}
+
+RomFile::RomFile() : length(0)
+{
+}
+
+/* The size of a ROM file or the reason it can't be loaded */
+static RomError check_size(uint64_t fileSize)
+{
+    if (fileSize == 0) {
+        return RomError::Empty;
+    }
+    if (fileSize > CHIP8_MAX_ROM_SIZE) {
+        return RomError::TooLarge;
+    }
+    return RomError::None;
+}
+
+#ifdef _WIN32
+
+RomError RomFile::open(const char* filePath)
+{
+    length = 0;
+
+    HANDLE file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return RomError::Open;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return RomError::NotAFile;
+    }
+    RomError error = check_size(static_cast<uint64_t>(fileSize.QuadPart));
+    if (error == RomError::None) {
+        DWORD read = 0;
+        const DWORD expected = static_cast<DWORD>(fileSize.QuadPart);
+        if (!ReadFile(file, bytes, expected, &read, nullptr) || read != expected) {
+            error = RomError::Read;
+        }
+    }
+    CloseHandle(file);
+
+    if (error == RomError::None) {
+        length = static_cast<size_t>(fileSize.QuadPart);
+    }
+    return error;
+}
+
+#else
+
+RomError RomFile::open(const char* filePath)
+{
+    length = 0;
+
+    const int file = ::open(filePath, O_RDONLY);
+    if (file < 0) {
+        return RomError::Open;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(file);
+        return RomError::NotAFile;
+    }
+    RomError error = check_size(static_cast<uint64_t>(info.st_size));
+
+    /* Regular files are read in one go unless a signal interrupts */
+    const size_t expected = static_cast<size_t>(info.st_size);
+    size_t total = 0;
+    while (error == RomError::None && total < expected) {
+        const ssize_t read = ::read(file, bytes + total, expected - total);
+        if (read > 0) {
+            total += static_cast<size_t>(read);
+        } else if (read == 0 || errno != EINTR) {
+            error = RomError::Read;
+        }
+    }
+    close(file);
+
+    if (error == RomError::None) {
+        length = expected;
+    }
+    return error;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "scheduler.h"
+#include "cpu.h"
+#include <thread>
+
+/* How far behind real time we let the emulator fall before giving up on catching up */
+static const int MAX_FRAMES_BEHIND = 5;
+
+Scheduler::Scheduler(CPU& cpu, Host& host, uint32_t instructionsPerFrame)
+    : cpu(cpu), host(host), instructionsPerFrame(instructionsPerFrame), turbo(false), frameCount(0),
+    epoch(Clock::now()), pacedFrames(0), lastPresent()
+{
+}
+
+uint32_t Scheduler::runFrame()
+{
+    const uint32_t executed = cpu.runFrame(instructionsPerFrame);
+    ++frameCount;
+
+    if (cpu.needsDraw()) {
+        /* In turbo mode there's no point showing more frames than the display can */
+        const Clock::time_point now = Clock::now();
+        if (!turbo || now - lastPresent >= FrameDuration(1)) {
+            host.present(cpu.getGFX(), cpu.getDirtyRows());
+            cpu.setDraw(false);
+            lastPresent = now;
+        }
+    }
+    return executed;
+}
+
+void Scheduler::waitForNextFrame()
+{
+    /* There's nothing to hurry through while FX0A waits for a key, so that's paced even in turbo mode */
+    if (turbo && !cpu.isWaitingForKey()) {
+        return;
+    }
+
+    ++pacedFrames;
+    const Clock::time_point nextFrame = epoch + std::chrono::duration_cast<Clock::duration>(FrameDuration(pacedFrames));
+    const Clock::time_point now = Clock::now();
+    if (now - nextFrame > FrameDuration(MAX_FRAMES_BEHIND)) {
+        /* We were stalled (e.g. the window was dragged) so start over rather than racing to catch up */
+        epoch = now;
+        pacedFrames = 0;
+        return;
+    }
+    std::this_thread::sleep_until(nextFrame);
+}
+
+void Scheduler::setTurbo(bool t)
+{
+    turbo = t;
+    if (!turbo) {
+        epoch = Clock::now();
+        pacedFrames = 0;
+    }
+}
+
+bool Scheduler::isTurbo() const
+{
+    return turbo;
+}
+
+uint64_t Scheduler::frames() const
+{
+    return frameCount;
+}
@@ -0,0 +1,139 @@
+#include "sdl_host.h"
+#include <iostream>
+#include "common.h"
+#include "framebuffer.h"
+
+/* Keyboard keys for the hex keypad 0x0 - 0xF */
+static const SDL_Scancode CHIP8_KEYMAP[CHIP8_KEY_COUNT] = {
+    SDL_SCANCODE_0,
+    SDL_SCANCODE_1,
+    SDL_SCANCODE_2,
+    SDL_SCANCODE_3,
+    SDL_SCANCODE_4,
+    SDL_SCANCODE_5,
+    SDL_SCANCODE_6,
+    SDL_SCANCODE_7,
+    SDL_SCANCODE_8,
+    SDL_SCANCODE_9,
+    SDL_SCANCODE_A,
+    SDL_SCANCODE_B,
+    SDL_SCANCODE_C,
+    SDL_SCANCODE_D,
+    SDL_SCANCODE_E,
+    SDL_SCANCODE_F
+};
+
+SdlHost::SdlHost(int scale) : win(nullptr), renderer(nullptr), texture(nullptr), keys(0), staleRows(CHIP8_ALL_ROWS)
+{
+    win = SDL_CreateWindow(
+        "Chip8 Emulator",
+        SDL_WINDOWPOS_CENTERED,
+        SDL_WINDOWPOS_CENTERED,
+        CHIP8_PIXELS_WIDTH * scale,
+        CHIP8_PIXELS_HEIGHT * scale,
+        0
+    );
+    if (!win) {
+        return;
+    }
+
+    /* Presenting waits for vsync where possible, but any renderer will do, including the software one */
+    renderer = SDL_CreateRenderer(win, -1, SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) {
+        renderer = SDL_CreateRenderer(win, -1, 0);
+    }
+    if (!renderer) {
+        return;
+    }
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                CHIP8_PIXELS_WIDTH, CHIP8_PIXELS_HEIGHT);
+}
+
+SdlHost::~SdlHost()
+{
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+    if (win) {
+        SDL_DestroyWindow(win);
+    }
+}
+
+bool SdlHost::isOpen() const
+{
+    return texture != nullptr;
+}
+
+bool SdlHost::handleEvent(const SDL_Event& event)
+{
+    if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
+        /* We won't hear about keys released in another window */
+        keys = 0;
+        return true;
+    }
+    if (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) {
+        return false;
+    }
+    for (int i = 0; i < CHIP8_KEY_COUNT; ++i) {
+        if (event.key.keysym.scancode == CHIP8_KEYMAP[i]) {
+            if (event.type == SDL_KEYDOWN) {
+                keys |= 1 << i;
+            } else {
+                keys &= ~(1 << i);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t SdlHost::keypad() const
+{
+    return keys;
+}
+
+void SdlHost::beep()
+{
+    std::cout << "BEEP!\n";
+}
+
+void SdlHost::present(const uint64_t* gfx, uint32_t dirtyRows)
+{
+    staleRows |= dirtyRows;
+
+    /* Upload each run of changed rows with one lock of just those rows */
+    int r = 0;
+    while (r < CHIP8_PIXELS_HEIGHT) {
+        if (!(staleRows & (1u << r))) {
+            ++r;
+            continue;
+        }
+        const int first = r;
+        while (r < CHIP8_PIXELS_HEIGHT && (staleRows & (1u << r))) {
+            ++r;
+        }
+
+        const SDL_Rect rect = { 0, first, CHIP8_PIXELS_WIDTH, r - first };
+        void* pixels = nullptr;
+        int pitch = 0;
+        if (SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0) {
+            return;
+        }
+        for (int y = first; y < r; ++y) {
+            uint32_t* line = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + (y - first) * pitch);
+            for (int c = 0; c < CHIP8_PIXELS_WIDTH; ++c) {
+                line[c] = framebuffer_pixel(gfx, c, y) ? 0xFFFFFFFF : 0xFF000000;
+            }
+        }
+        SDL_UnlockTexture(texture);
+    }
+    staleRows = 0;
+
+    /* The renderer does the scaling */
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,32 @@
+#include "snapshot.h"
+#include "cpu.h"
+#include <cstdio>
+#include <vector>
+
+bool save_state_file(const CPU& cpu, const char* path)
+{
+    std::vector<uint8_t> buffer(CPU::snapshotSize());
+    if (!cpu.save(buffer.data(), buffer.size())) {
+        return false;
+    }
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    const bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    return std::fclose(file) == 0 && written;
+}
+
+bool load_state_file(CPU& cpu, const char* path)
+{
+    std::FILE* file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> buffer(CPU::snapshotSize());
+    const size_t read = std::fread(buffer.data(), 1, buffer.size(), file);
+    std::fclose(file);
+
+    return read == buffer.size() && cpu.load(buffer.data(), buffer.size());
+}
@@ -0,0 +1,64 @@
+#include "trace.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+thread_local TraceRing* trace_ring = nullptr;
+
+/* Rings are never freed so that they can still be written out after their thread is gone */
+static std::mutex ringsLock;
+static std::vector<TraceRing*> rings;
+
+TraceRing* trace_attach()
+{
+    TraceRing* ring = new TraceRing();
+    ring->next.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(ringsLock);
+    ring->thread = static_cast<uint32_t>(rings.size());
+    rings.push_back(ring);
+    trace_ring = ring;
+    return ring;
+}
+
+const char* trace_event_name(TraceEvent event)
+{
+    switch (event) {
+#define CHIP8_TRACE_EVENT_NAME(name) case TraceEvent::name: return #name;
+    CHIP8_TRACE_EVENTS(CHIP8_TRACE_EVENT_NAME)
+#undef CHIP8_TRACE_EVENT_NAME
+    default:
+        return "Unknown";
+    }
+}
+
+bool trace_write_file(const char* path)
+{
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(ringsLock);
+
+    TraceFileHeader header;
+    std::memcpy(header.magic, "C8TR", sizeof(header.magic));
+    header.version = CHIP8_TRACE_FILE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.ringCount = static_cast<uint32_t>(rings.size());
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (const TraceRing* ring : rings) {
+        const uint32_t next = ring->next.load(std::memory_order_acquire);
+        const TraceFileRing info = { ring->thread, next < CHIP8_TRACE_RING_SIZE ? next : CHIP8_TRACE_RING_SIZE };
+        written = written && std::fwrite(&info, sizeof(info), 1, file) == 1;
+
+        /* Oldest first, which may mean starting halfway through the ring */
+        for (uint32_t i = 0; i < info.count; ++i) {
+            const TraceRecord& record = ring->records[(next - info.count + i) & (CHIP8_TRACE_RING_SIZE - 1)];
+            written = written && std::fwrite(&record, sizeof(record), 1, file) == 1;
+        }
+    }
+    return std::fclose(file) == 0 && written;
+}
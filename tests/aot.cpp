@@ -0,0 +1,96 @@
+#include "aot.h"
+#include "headless.h"
+#include "test.h"
+
+/*
+ * Programs translated by chip8-aot at build time, see CMakeLists.txt. The AOT engine has to leave
+ * the machine in exactly the state the interpreter does.
+ */
+extern const AotProgram STARS_AOT_PROGRAM;
+extern const AotProgram CHIP8LOGO_AOT_PROGRAM;
+extern const AotProgram CALLS_AOT_PROGRAM;
+
+static const uint32_t FRAMES = 3000;
+static const uint32_t FRAMES_PER_COMPARISON = 50;
+
+static void check_example(const char* name, const AotProgram& program)
+{
+    test_context(std::string(name) + " on aot");
+    RomFile rom;
+    if (!load_example(rom, name)) {
+        return;
+    }
+
+    CPU reference(rom.data(), rom.size());
+    CPU cpu(rom.data(), rom.size());
+    if (!CHECK(cpu.loadProgram(program))) {
+        return;
+    }
+    cpu.setEngine(Engine::Aot);
+
+    for (uint32_t frame = 0; frame < FRAMES; frame += FRAMES_PER_COMPARISON) {
+        for (uint32_t i = 0; i < FRAMES_PER_COMPARISON; ++i) {
+            reference.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+            cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+        }
+        if (!CHECK(hash_framebuffer(cpu.getGFX()) == hash_framebuffer(reference.getGFX()))) {
+            return;
+        }
+    }
+    CHECK(snapshot_of(cpu) == snapshot_of(reference));
+}
+
+/*
+ * calls.ch8 draws the digits 0 to 7 along the top of the screen through a subroutine that calls
+ * another one to point I at the digit, then stops in a jump to itself at HALT_ADDRESS:
+ *
+ *   0x200 00E0 6000              clear, V0 = 0
+ *   0x204 2210 7008 3040 1204    call 0x210, V0 += 8, loop until V0 == 64
+ *   0x20C 120C                   halt
+ *   0x210 221A 6100 D015 00EE    call 0x21A, V1 = 0, draw the digit at (V0, V1), return
+ *   0x21A 8200 8226 8226 8226    V2 = V0 / 8
+ *   0x222 F229 00EE              I = digit V2, return
+ */
+static const uint16_t HALT_ADDRESS = 0x20C;
+
+/* The top rows of the font's digits 0 to 7 side by side */
+static const uint64_t CALLS_TOP_ROW = 0xF020F0F090F0F0F0;
+
+static void check_calls(const RomFile& rom, Engine engine, const std::vector<uint8_t>& expected)
+{
+    test_context(std::string("calls.ch8 on ") + engine_name(engine));
+    CPU cpu(rom.data(), rom.size());
+    if (engine == Engine::Aot && !CHECK(cpu.loadProgram(CALLS_AOT_PROGRAM))) {
+        return;
+    }
+    cpu.setEngine(engine);
+
+    const RunResult result = cpu.runUntil(CHIP8_STOP_PC, 1000, HALT_ADDRESS);
+    CHECK(result.event == CHIP8_STOP_PC);
+    CHECK(cpu.getGFX()[0] == CALLS_TOP_ROW);
+    if (!expected.empty()) {
+        CHECK(snapshot_of(cpu) == expected);
+    }
+}
+
+void test_aot()
+{
+    check_example("stars.ch8", STARS_AOT_PROGRAM);
+    check_example("chip8logo.ch8", CHIP8LOGO_AOT_PROGRAM);
+
+    RomFile rom;
+    if (!load_test_rom(rom, "calls.ch8")) {
+        return;
+    }
+    /* Every engine has to return to the instruction after each call */
+    CPU reference(rom.data(), rom.size());
+    reference.runUntil(CHIP8_STOP_PC, 1000, HALT_ADDRESS);
+    const std::vector<uint8_t> expected = snapshot_of(reference);
+
+    check_calls(rom, Engine::Switch, std::vector<uint8_t>());
+    for (Engine engine : { Engine::Threaded, Engine::Jit, Engine::Aot }) {
+        if (CPU::hasEngine(engine)) {
+            check_calls(rom, engine, expected);
+        }
+    }
+}
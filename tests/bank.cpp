@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include "cpu_bank.h"
+#include "headless.h"
+#include "test.h"
+
+/*
+ * Every lane of a CPUBank has to stay exactly where a CPU of its own would be. Lanes get seeds of
+ * their own, so stars.ch8 runs them apart and back together again, and pairs of lanes share a
+ * seed so that some of them always have company to run in lockstep with.
+ *
+ * The vector kernels work on 32 byte or 16 word lanes at a time and leave the rest to a scalar
+ * loop, so this many lanes takes both paths.
+ */
+
+static const size_t LANES = 40;
+static const uint32_t FRAMES = 3000;
+static const uint32_t FRAMES_PER_COMPARISON = 50;
+
+/* Reads a field of the CPUState in the snapshot of 'cpu' */
+template <typename T>
+static T state_field(const CPU& cpu, size_t offset)
+{
+    const std::vector<uint8_t> snapshot = snapshot_of(cpu);
+    T value;
+    std::memcpy(&value, snapshot.data() + CPU::snapshotSize() - sizeof(CPUState) + offset, sizeof(value));
+    return value;
+}
+
+static bool same_as_cpu(const CPUBank<LANES>& bank, size_t lane, const CPU& cpu)
+{
+    bool same = bank.getPC(lane) == state_field<uint16_t>(cpu, offsetof(CPUState, pc)) &&
+        bank.getSP(lane) == state_field<uint16_t>(cpu, offsetof(CPUState, sp)) &&
+        hash_framebuffer(bank.getGFX(lane)) == hash_framebuffer(cpu.getGFX());
+    for (uint8_t reg = 0; reg < CHIP8_REGISTER_COUNT; ++reg) {
+        same &= bank.getV(lane, reg) == state_field<uint8_t>(cpu, offsetof(CPUState, V) + reg);
+    }
+    return same;
+}
+
+/* 'diverges' if the ROM draws random numbers, which runs lanes with different seeds apart */
+static void check_example(const char* name, bool diverges)
+{
+    RomFile rom;
+    if (!load_example(rom, name)) {
+        return;
+    }
+
+    std::unique_ptr<CPUBank<LANES>> bank(new CPUBank<LANES>(rom.data(), rom.size()));
+    std::vector<std::unique_ptr<CPU>> cpus;
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        cpus.emplace_back(new CPU(rom.data(), rom.size()));
+        cpus[lane]->setSeed(lane / 2);
+        bank->setSeed(lane, lane / 2);
+    }
+
+    for (uint32_t frame = 0; frame < FRAMES; frame += FRAMES_PER_COMPARISON) {
+        for (uint32_t i = 0; i < FRAMES_PER_COMPARISON; ++i) {
+            bank->run(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+            bank->tickTimers();
+            for (std::unique_ptr<CPU>& cpu : cpus) {
+                cpu->runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+            }
+        }
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            test_context(std::string(name) + " on lane " + std::to_string(lane) + " after " + std::to_string(frame + FRAMES_PER_COMPARISON) + " frames");
+            if (!CHECK(same_as_cpu(*bank, lane, *cpus[lane]))) {
+                return;
+            }
+        }
+    }
+
+    /* Both ways of stepping have to have been checked */
+    test_context(name);
+    CHECK(bank->lockstepSteps() != 0);
+    CHECK(!diverges || bank->divergentSteps() != 0);
+}
+
+/* A ROM of 'program' at CHIP8_START_ADDRESS and 'top' at the very end of memory */
+static std::vector<uint8_t> make_rom(const std::vector<uint16_t>& program, const std::vector<uint8_t>& top)
+{
+    std::vector<uint8_t> rom(CHIP8_MEMORY_SIZE - CHIP8_START_ADDRESS, 0);
+    for (size_t i = 0; i < program.size(); ++i) {
+        rom[2 * i] = static_cast<uint8_t>(program[i] >> 8);
+        rom[2 * i + 1] = static_cast<uint8_t>(program[i]);
+    }
+    std::copy(top.begin(), top.end(), rom.end() - top.size());
+    return rom;
+}
+
+/* Steps every lane and its CPU one instruction at a time, comparing them after each one */
+static void check_steps(const char* what, const std::vector<uint8_t>& rom, uint32_t steps)
+{
+    std::unique_ptr<CPUBank<LANES>> bank(new CPUBank<LANES>(rom.data(), rom.size()));
+    std::vector<std::unique_ptr<CPU>> cpus;
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        cpus.emplace_back(new CPU(rom.data(), rom.size()));
+        cpus[lane]->setSeed(lane);
+        bank->setSeed(lane, lane);
+    }
+
+    for (uint32_t step = 1; step <= steps; ++step) {
+        bank->run(1);
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            cpus[lane]->run(1);
+            test_context(std::string(what) + " on lane " + std::to_string(lane) + " after " + std::to_string(step) + " steps");
+            if (!CHECK(same_as_cpu(*bank, lane, *cpus[lane]))) {
+                return;
+            }
+        }
+    }
+}
+
+void test_bank()
+{
+    check_example("stars.ch8", true);
+    check_example("chip8logo.ch8", false);
+
+    /*
+     * The last 48 bytes of memory add to V1 from any alignment, and add or skip their way past the
+     * end of memory into the font. All lanes get there together with JP, each on its own with BNNN.
+     */
+    std::vector<uint8_t> top(0x30, 0x71);
+    check_steps("JP near the end of memory", make_rom({ 0x1FD0 }, top), 32);
+    top[0x2E] = 0x30;
+    top[0x2F] = 0x00;
+    check_steps("JP to a skip at the end of memory", make_rom({ 0x1FD0 }, top), 32);
+    check_steps("BNNN near the end of memory", make_rom({ 0xC03F, 0xBFD0 }, top), 48);
+
+    /* Calls nest 19 deep, past the end of the stack, then RET goes round and round the stack */
+    check_steps("stack overflow", make_rom({ 0x7101, 0x3114, 0x2200, 0x00EE }, std::vector<uint8_t>()), 120);
+}
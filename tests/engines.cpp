@@ -0,0 +1,152 @@
+#include "headless.h"
+#include "rng.h"
+#include "test.h"
+
+/*
+ * Every engine has to leave the machine in exactly the state the switch engine does. Machines
+ * are compared whole, through their snapshots, every few frames so that a difference shows up
+ * close to where it started.
+ */
+
+static const uint32_t FRAMES = 3000;
+static const uint32_t FRAMES_PER_COMPARISON = 50;
+
+/* Frames run with runFrame(), then the same number run event by event with runUntil() */
+static void check_engine(const RomFile& rom, const char* name, Engine engine)
+{
+    test_context(std::string(name) + " on " + engine_name(engine));
+
+    CPU reference(rom.data(), rom.size());
+    CPU cpu(rom.data(), rom.size());
+    cpu.setEngine(engine);
+
+    for (uint32_t frame = 0; frame < FRAMES; frame += FRAMES_PER_COMPARISON) {
+        for (uint32_t i = 0; i < FRAMES_PER_COMPARISON; ++i) {
+            reference.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+            cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+        }
+        if (!CHECK(snapshot_of(cpu) == snapshot_of(reference))) {
+            return;
+        }
+    }
+    CHECK(cpu.idleCycles() == reference.idleCycles());
+
+    for (uint32_t frame = 0; frame < FRAMES; ++frame) {
+        const RunResult expected = reference.runUntil(CHIP8_STOP_DRAW | CHIP8_STOP_SOUND, CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+        const RunResult result = cpu.runUntil(CHIP8_STOP_DRAW | CHIP8_STOP_SOUND, CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+        if (!CHECK(result.executed == expected.executed && result.event == expected.event)) {
+            return;
+        }
+        reference.tickTimers();
+        cpu.tickTimers();
+    }
+    CHECK(snapshot_of(cpu) == snapshot_of(reference));
+    CHECK(hash_framebuffer(cpu.getGFX()) == hash_framebuffer(reference.getGFX()));
+}
+
+/*
+ * Random programs reach what the examples never do: held keys, FX0A, invalid opcodes, stores over
+ * code that has already been translated and runUntil() stopping at an address. Each instruction
+ * is any opcode with random operands, except that addresses stay inside the program so that
+ * branches and stores land on its code, and now and then an FX07 idle loop goes in instead.
+ * Every frame holds other random keys and alternates between runFrame() and runUntil().
+ */
+static const uint32_t RANDOM_PROGRAMS = 300;
+static const uint32_t RANDOM_INSTRUCTIONS = 256;
+static const uint32_t RANDOM_FRAMES = 60;
+
+/* Every opcode with its operands cleared and the operands it takes, the last one is invalid */
+static const uint16_t OPCODES[][2] = {
+    { 0x00E0, 0x0000 }, { 0x00EE, 0x0000 }, { 0x1000, 0x0FFF }, { 0x2000, 0x0FFF }, { 0x3000, 0x0FFF },
+    { 0x4000, 0x0FFF }, { 0x5000, 0x0FF0 }, { 0x6000, 0x0FFF }, { 0x7000, 0x0FFF }, { 0x8000, 0x0FF0 },
+    { 0x8001, 0x0FF0 }, { 0x8002, 0x0FF0 }, { 0x8003, 0x0FF0 }, { 0x8004, 0x0FF0 }, { 0x8005, 0x0FF0 },
+    { 0x8006, 0x0FF0 }, { 0x8007, 0x0FF0 }, { 0x800E, 0x0FF0 }, { 0x9000, 0x0FF0 }, { 0xA000, 0x0FFF },
+    { 0xB000, 0x0FFF }, { 0xC000, 0x0FFF }, { 0xD000, 0x0FFF }, { 0xE09E, 0x0F00 }, { 0xE0A1, 0x0F00 },
+    { 0xF007, 0x0F00 }, { 0xF00A, 0x0F00 }, { 0xF015, 0x0F00 }, { 0xF018, 0x0F00 }, { 0xF01E, 0x0F00 },
+    { 0xF029, 0x0F00 }, { 0xF033, 0x0F00 }, { 0xF055, 0x0F00 }, { 0xF065, 0x0F00 }, { 0xF0FF, 0x0000 }
+};
+static const uint32_t OPCODE_COUNT = sizeof(OPCODES) / sizeof(OPCODES[0]);
+
+static std::vector<uint8_t> random_program(uint64_t& state)
+{
+    std::vector<uint16_t> program;
+    while (program.size() < RANDOM_INSTRUCTIONS) {
+        const uint16_t at = static_cast<uint16_t>(CHIP8_START_ADDRESS + 2 * program.size());
+        const uint16_t operands = static_cast<uint16_t>(rng_next_byte(state) << 8 | rng_next_byte(state));
+        const uint32_t pick = rng_next_byte(state) % (OPCODE_COUNT + 2);
+        if (pick >= OPCODE_COUNT) {
+            /* FX07, 3X00, 1NNN back to the FX07 */
+            const uint16_t x = operands & 0x0F00;
+            program.insert(program.end(), { static_cast<uint16_t>(0xF007 | x), static_cast<uint16_t>(0x3000 | x), static_cast<uint16_t>(0x1000 | at) });
+            continue;
+        }
+        uint16_t opcode = OPCODES[pick][0] | (operands & OPCODES[pick][1]);
+        if (OPCODES[pick][1] == 0x0FFF && (opcode >> 12 == 0x1 || opcode >> 12 == 0x2 || opcode >> 12 == 0xA || opcode >> 12 == 0xB)) {
+            opcode = static_cast<uint16_t>((opcode & 0xF000) | (CHIP8_START_ADDRESS + (operands & 0x1FF)));
+        }
+        program.push_back(opcode);
+    }
+
+    std::vector<uint8_t> rom;
+    for (uint16_t opcode : program) {
+        rom.push_back(static_cast<uint8_t>(opcode >> 8));
+        rom.push_back(static_cast<uint8_t>(opcode));
+    }
+    return rom;
+}
+
+static void check_random_programs(Engine engine)
+{
+    uint64_t state = rng_seed(1);
+    for (uint32_t program = 0; program < RANDOM_PROGRAMS; ++program) {
+        test_context("random program " + std::to_string(program) + " on " + engine_name(engine));
+
+        const std::vector<uint8_t> rom = random_program(state);
+        CPU reference(rom.data(), rom.size());
+        CPU cpu(rom.data(), rom.size());
+        cpu.setEngine(engine);
+
+        for (uint32_t frame = 0; frame < RANDOM_FRAMES; ++frame) {
+            const uint16_t keys = static_cast<uint16_t>(rng_next_byte(state) << 8 | rng_next_byte(state));
+            reference.setKeys(keys);
+            cpu.setKeys(keys);
+
+            if (frame % 2 == 0) {
+                reference.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+                cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+            } else {
+                const uint16_t stopAt = static_cast<uint16_t>(CHIP8_START_ADDRESS + 2 * rng_next_byte(state));
+                const uint32_t events = CHIP8_STOP_DRAW | CHIP8_STOP_SOUND | (frame % 4 == 1 ? CHIP8_STOP_PC : 0);
+                const RunResult expected = reference.runUntil(events, CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME, stopAt);
+                const RunResult result = cpu.runUntil(events, CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME, stopAt);
+                if (!CHECK(result.executed == expected.executed && result.event == expected.event)) {
+                    return;
+                }
+            }
+            if (!CHECK(snapshot_of(cpu) == snapshot_of(reference))) {
+                return;
+            }
+        }
+        CHECK(cpu.idleCycles() == reference.idleCycles());
+    }
+}
+
+void test_engines()
+{
+    for (const char* name : { "stars.ch8", "chip8logo.ch8" }) {
+        RomFile rom;
+        if (!load_example(rom, name)) {
+            continue;
+        }
+        for (Engine engine : { Engine::Threaded, Engine::Jit }) {
+            if (CPU::hasEngine(engine)) {
+                check_engine(rom, name, engine);
+            }
+        }
+    }
+    for (Engine engine : { Engine::Threaded, Engine::Jit }) {
+        if (CPU::hasEngine(engine)) {
+            check_random_programs(engine);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "test.h"
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+static const Test TESTS[] = {
+    { "engines", test_engines },
+    { "aot", test_aot },
+    { "bank", test_bank },
+    { "snapshot", test_snapshot },
+    { "rewind", test_rewind },
+    { "movie", test_movie },
+};
+
+static uint64_t failures;
+static std::string currentContext;
+
+bool test_check(bool passed, const char* expression, const char* file, int line)
+{
+    if (!passed) {
+        ++failures;
+        std::fprintf(stderr, "%s:%d: %s%sCHECK(%s) failed\n", file, line, currentContext.c_str(),
+                     currentContext.empty() ? "" : ": ", expression);
+    }
+    return passed;
+}
+
+void test_context(const std::string& context)
+{
+    currentContext = context;
+}
+
+static bool load_rom(RomFile& rom, const char* directory, const char* name)
+{
+    const std::string path = std::string(directory) + "/" + name;
+    const RomError error = rom.open(path.c_str());
+    if (error != RomError::None) {
+        std::fprintf(stderr, "Couldn't load '%s': %s!\n", path.c_str(), rom_error_message(error));
+        ++failures;
+        return false;
+    }
+    return true;
+}
+
+bool load_example(RomFile& rom, const char* name)
+{
+    return load_rom(rom, CHIP8TEST_EXAMPLES_DIR, name);
+}
+
+bool load_test_rom(RomFile& rom, const char* name)
+{
+    return load_rom(rom, CHIP8TEST_ROMS_DIR, name);
+}
+
+std::string test_output_path(const char* name)
+{
+    return std::string(CHIP8TEST_OUTPUT_DIR) + "/" + name;
+}
+
+std::vector<uint8_t> snapshot_of(const CPU& cpu)
+{
+    std::vector<uint8_t> snapshot(CPU::snapshotSize());
+    cpu.save(snapshot.data(), snapshot.size());
+    return snapshot;
+}
+
+const char* engine_name(Engine engine)
+{
+    switch (engine) {
+    case Engine::Switch:   return "switch";
+    case Engine::Threaded: return "threaded";
+    case Engine::Jit:      return "jit";
+    case Engine::Aot:      return "aot";
+    }
+    return "unknown";
+}
+
+static bool run_test(const Test& test)
+{
+    const uint64_t before = failures;
+    test_context("");
+    test.run();
+    const bool passed = failures == before;
+    std::printf("%s: %s\n", test.name, passed ? "passed" : "FAILED");
+    return passed;
+}
+
+int main(int argc, char** argv)
+{
+    bool passed = true;
+    if (argc < 2) {
+        for (const Test& test : TESTS) {
+            passed &= run_test(test);
+        }
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        const Test* found = nullptr;
+        for (const Test& test : TESTS) {
+            if (std::strcmp(test.name, argv[i]) == 0) {
+                found = &test;
+            }
+        }
+        if (found == nullptr) {
+            std::fprintf(stderr, "There's no test called '%s'!\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        passed &= run_test(*found);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
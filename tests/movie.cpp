@@ -0,0 +1,182 @@
+#include <cstdio>
+#include "movie.h"
+#include "test.h"
+
+/*
+ * Playing a movie back has to end exactly where the recorded run did, and a movie file that was
+ * cut short or damaged has to be turned down without touching the movie it was loaded into.
+ */
+
+static const uint32_t FRAMES = 1200;
+
+/* Keys change every this many frames, so the movie holds a few dozen runs */
+static const uint32_t FRAMES_PER_KEY = 37;
+
+/* Where the run count is in a movie file: after the magic, version, seed and instructions per frame */
+static const size_t RUN_COUNT_OFFSET = 4 + 4 + 8 + 4;
+
+static std::vector<uint8_t> read_file(const std::string& path)
+{
+    std::vector<uint8_t> bytes;
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return bytes;
+    }
+    int c;
+    while ((c = std::fgetc(file)) != EOF) {
+        bytes.push_back(static_cast<uint8_t>(c));
+    }
+    std::fclose(file);
+    return bytes;
+}
+
+static void write_file(const std::string& path, const uint8_t* bytes, size_t size)
+{
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file != nullptr) {
+        std::fwrite(bytes, 1, size, file);
+        std::fclose(file);
+    }
+}
+
+static bool same_movie(const Movie& a, const Movie& b)
+{
+    if (a.seed != b.seed || a.instructionsPerFrame != b.instructionsPerFrame || a.runs.size() != b.runs.size()) {
+        return false;
+    }
+    for (size_t r = 0; r < a.runs.size(); ++r) {
+        if (a.runs[r].frames != b.runs[r].frames || a.runs[r].keys != b.runs[r].keys) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Runs the ROM with keys going down and up like a player would, recording them into 'movie' */
+static void record(CPU& cpu, Movie& movie)
+{
+    cpu.setSeed(movie.seed);
+    for (uint32_t frame = 0; frame < FRAMES; ++frame) {
+        const uint32_t step = frame / FRAMES_PER_KEY;
+        const uint16_t keys = step % 3 == 0 ? 0 : static_cast<uint16_t>(1 << (step % 16));
+        cpu.setKeys(keys);
+        cpu.runFrame(movie.instructionsPerFrame);
+        cpu.setDraw(false);
+        movie_record(movie, keys);
+    }
+}
+
+/*
+ * beeps.ch8 starts a two frame sound and then waits ten frames for the delay timer, over and over:
+ *
+ *   0x200 6002 F018              V0 = 2, sound = V0
+ *   0x204 610A F115              V1 = 10, delay = V1
+ *   0x208 F107 3100 1208 1202    wait until the delay is 0, then start the next sound
+ */
+static void check_beeps()
+{
+    test_context("beeps.ch8 played back");
+    RomFile rom;
+    if (!load_test_rom(rom, "beeps.ch8")) {
+        return;
+    }
+
+    Movie movie;
+    CPU recorded(rom.data(), rom.size());
+    HeadlessHost recordedHost;
+    recorded.setHost(&recordedHost);
+    record(recorded, movie);
+    CHECK(recordedHost.beeps > FRAMES / 20);
+
+    /* Playback beeps to the given host, then the CPU's own host gets them again */
+    CPU played(rom.data(), rom.size());
+    HeadlessHost ownHost;
+    played.setHost(&ownHost);
+    HeadlessHost host;
+    play_movie(played, host, movie);
+    CHECK(host.beeps == recordedHost.beeps);
+    CHECK(ownHost.beeps == 0);
+    CHECK(played.getHost() == &ownHost);
+}
+
+/* Loading the file holding 'bytes' has to fail and leave the movie it's loaded into alone */
+static void check_rejected(const char* what, const std::vector<uint8_t>& bytes, size_t size)
+{
+    test_context(what);
+    const std::string path = test_output_path("damaged.movie");
+    write_file(path, bytes.data(), size);
+
+    Movie movie;
+    movie.seed = 99;
+    movie_record(movie, 0x1);
+    const Movie before = movie;
+    CHECK(!load_movie_file(movie, path.c_str()));
+    CHECK(same_movie(movie, before));
+    std::remove(path.c_str());
+}
+
+void test_movie()
+{
+    RomFile rom;
+    if (!load_example(rom, "stars.ch8")) {
+        return;
+    }
+
+    test_context("record and play back");
+    Movie movie;
+    movie.seed = 1234;
+    movie.instructionsPerFrame = 15;
+    CPU recorded(rom.data(), rom.size());
+    record(recorded, movie);
+    CHECK(movie_frames(movie) == FRAMES);
+    CHECK(movie.runs.size() > 1 && movie.runs.size() < FRAMES);
+
+    const std::string path = test_output_path("test.movie");
+    CHECK(save_movie_file(movie, path.c_str()));
+    Movie loaded;
+    CHECK(load_movie_file(loaded, path.c_str()));
+    CHECK(same_movie(loaded, movie));
+
+    CPU played(rom.data(), rom.size());
+    HeadlessHost host;
+    const HeadlessResult result = play_movie(played, host, loaded);
+    CHECK(result.cycles == static_cast<uint64_t>(FRAMES) * movie.instructionsPerFrame);
+    CHECK(result.framebufferHash == hash_framebuffer(recorded.getGFX()));
+    CHECK(snapshot_of(played) == snapshot_of(recorded));
+
+    const std::vector<uint8_t> good = read_file(path);
+    std::remove(path.c_str());
+    if (!CHECK(!good.empty())) {
+        return;
+    }
+
+    /* Cut short anywhere, in the header or in the middle of a run */
+    for (size_t size = 0; size < good.size(); ++size) {
+        check_rejected(("truncated to " + std::to_string(size) + " bytes").c_str(), good, size);
+    }
+
+    std::vector<uint8_t> bad = good;
+    bad.push_back(0);
+    check_rejected("trailing byte", bad, bad.size());
+
+    bad = good;
+    bad[0] ^= 0xFF;
+    check_rejected("bad magic", bad, bad.size());
+
+    bad = good;
+    bad[4] ^= 0xFF;
+    check_rejected("other version", bad, bad.size());
+
+    /* A run count far beyond the file's size mustn't be believed */
+    bad = good;
+    for (size_t i = 0; i < 4; ++i) {
+        bad[RUN_COUNT_OFFSET + i] = 0xFF;
+    }
+    check_rejected("huge run count", bad, bad.size());
+
+    bad = good;
+    ++bad[RUN_COUNT_OFFSET];
+    check_rejected("one run too many", bad, bad.size());
+
+    check_beeps();
+}
@@ -0,0 +1,110 @@
+#include "rewind.h"
+#include "scheduler.h"
+#include "test.h"
+
+/*
+ * Every step back has to restore, byte for byte, the snapshot taken at that point, newest first.
+ * Restoring marks every row of the screen to be drawn again, so like the window the test clears
+ * that after each frame and after each step before the machine is compared.
+ */
+
+static const uint32_t INTERVAL = 2;
+
+/* Frames run into the history, ending with one that wasn't snapshotted */
+static const uint32_t FRAMES = 600;
+
+/* Runs FRAMES frames into 'rewind' and returns the snapshots it took, oldest first */
+static std::vector<std::vector<uint8_t>> record(CPU& cpu, Rewind& rewind)
+{
+    std::vector<std::vector<uint8_t>> history;
+    for (uint32_t frame = 0; frame < FRAMES; ++frame) {
+        cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+        cpu.setDraw(false);
+        rewind.onFrame(cpu);
+        if (frame % INTERVAL == 0) {
+            history.push_back(snapshot_of(cpu));
+        }
+    }
+    return history;
+}
+
+/* Steps back until the history runs out and returns how many steps matched 'history', newest first */
+static size_t step_back_all(CPU& cpu, Rewind& rewind, const std::vector<std::vector<uint8_t>>& history)
+{
+    const size_t depth = rewind.depth();
+    size_t steps = 0;
+    while (rewind.stepBack(cpu)) {
+        cpu.setDraw(false);
+        if (!CHECK(steps < history.size() && snapshot_of(cpu) == history[history.size() - 1 - steps])) {
+            break;
+        }
+        ++steps;
+        CHECK(rewind.depth() == depth - steps);
+    }
+    return steps;
+}
+
+static void check_whole_history(const RomFile& rom)
+{
+    test_context("whole history");
+    CPU cpu(rom.data(), rom.size());
+    Rewind rewind(1 << 20, INTERVAL);
+    const std::vector<std::vector<uint8_t>> history = record(cpu, rewind);
+    CHECK(rewind.depth() == history.size());
+
+    const size_t steps = step_back_all(cpu, rewind, history);
+    CHECK(steps == history.size());
+
+    /* Once the history runs out the machine stays at the oldest snapshot */
+    CHECK(snapshot_of(cpu) == history.front());
+    CHECK(rewind.depth() == 0);
+}
+
+static void check_full_ring(const RomFile& rom)
+{
+    test_context("full ring");
+    CPU cpu(rom.data(), rom.size());
+    Rewind rewind(1024, INTERVAL);
+    const std::vector<std::vector<uint8_t>> history = record(cpu, rewind);
+    CHECK(rewind.bytesUsed() <= 1024);
+
+    /* The oldest snapshots were dropped, the newest are all still there */
+    const size_t steps = step_back_all(cpu, rewind, history);
+    CHECK(steps > 1 && steps < history.size());
+}
+
+static void check_resume(const RomFile& rom)
+{
+    test_context("running on after stepping back");
+    CPU cpu(rom.data(), rom.size());
+    Rewind rewind(1 << 20, INTERVAL);
+    std::vector<std::vector<uint8_t>> history = record(cpu, rewind);
+    for (int i = 0; i < 10; ++i) {
+        CHECK(rewind.stepBack(cpu));
+    }
+    cpu.setDraw(false);
+    history.resize(history.size() - 9);
+    CHECK(snapshot_of(cpu) == history.back());
+
+    /* The snapshot stepped back to counts as the newest, the next one is taken 'INTERVAL' frames on */
+    for (uint32_t frame = 0; frame <= INTERVAL; ++frame) {
+        cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+        cpu.setDraw(false);
+        rewind.onFrame(cpu);
+        if (frame == INTERVAL - 1) {
+            history.push_back(snapshot_of(cpu));
+        }
+    }
+    CHECK(step_back_all(cpu, rewind, history) == history.size());
+}
+
+void test_rewind()
+{
+    RomFile rom;
+    if (!load_example(rom, "stars.ch8")) {
+        return;
+    }
+    check_whole_history(rom);
+    check_full_ring(rom);
+    check_resume(rom);
+}
@@ -0,0 +1,125 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include "headless.h"
+#include "snapshot.h"
+#include "test.h"
+
+/*
+ * A restored snapshot has to carry on exactly like the machine it was taken from, and a snapshot
+ * that would put the CPU outside of its arrays has to be turned down without touching the machine.
+ */
+
+static const uint32_t FRAMES = 600;
+
+static size_t header_size()
+{
+    return CPU::snapshotSize() - sizeof(CPUState);
+}
+
+template <typename T>
+static void set_field(std::vector<uint8_t>& snapshot, size_t offset, T value)
+{
+    std::memcpy(snapshot.data() + header_size() + offset, &value, sizeof(value));
+}
+
+static void run_frames(CPU& cpu, uint32_t frames)
+{
+    for (uint32_t i = 0; i < frames; ++i) {
+        cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+    }
+}
+
+static void check_round_trip(const RomFile& rom)
+{
+    test_context("round trip");
+    CPU cpu(rom.data(), rom.size());
+    cpu.setSeed(7);
+    run_frames(cpu, FRAMES);
+    const std::vector<uint8_t> snapshot = snapshot_of(cpu);
+
+    CPU restored(rom.data(), rom.size());
+    CHECK(restored.load(snapshot.data(), snapshot.size()));
+    CHECK(snapshot_of(restored) == snapshot);
+
+    run_frames(cpu, FRAMES);
+    run_frames(restored, FRAMES);
+    CHECK(snapshot_of(restored) == snapshot_of(cpu));
+    CHECK(hash_framebuffer(restored.getGFX()) == hash_framebuffer(cpu.getGFX()));
+
+    test_context("round trip through a file");
+    const std::string path = test_output_path("snapshot.state");
+    CHECK(save_state_file(cpu, path.c_str()));
+    CPU fromFile(rom.data(), rom.size());
+    CHECK(load_state_file(fromFile, path.c_str()));
+    CHECK(snapshot_of(fromFile) == snapshot_of(cpu));
+    std::remove(path.c_str());
+}
+
+/* Loading 'snapshot' has to fail and leave the machine exactly as it was */
+static void check_rejected(const RomFile& rom, const char* what, const std::vector<uint8_t>& snapshot, size_t size)
+{
+    test_context(what);
+    CPU cpu(rom.data(), rom.size());
+    run_frames(cpu, FRAMES / 2);
+    const std::vector<uint8_t> before = snapshot_of(cpu);
+    CHECK(!cpu.load(snapshot.data(), size));
+    CHECK(snapshot_of(cpu) == before);
+}
+
+static void check_damaged(const RomFile& rom)
+{
+    CPU cpu(rom.data(), rom.size());
+    run_frames(cpu, FRAMES);
+    const std::vector<uint8_t> good = snapshot_of(cpu);
+    std::vector<uint8_t> bad;
+
+    check_rejected(rom, "truncated", good, good.size() - 1);
+
+    bad = good;
+    bad[0] ^= 0xFF;
+    check_rejected(rom, "bad magic", bad, bad.size());
+
+    /* The version and the state size follow the four byte magic */
+    bad = good;
+    bad[4] ^= 0xFF;
+    check_rejected(rom, "other version", bad, bad.size());
+
+    bad = good;
+    bad[8] ^= 0xFF;
+    check_rejected(rom, "other state size", bad, bad.size());
+
+    bad = good;
+    set_field<uint16_t>(bad, offsetof(CPUState, sp), CHIP8_STACK_DEPTH);
+    check_rejected(rom, "sp out of range", bad, bad.size());
+
+    bad = good;
+    set_field<uint16_t>(bad, offsetof(CPUState, pc), CHIP8_MEMORY_SIZE);
+    check_rejected(rom, "pc out of range", bad, bad.size());
+
+    bad = good;
+    set_field<uint8_t>(bad, offsetof(CPUState, waiting_for_key), 2);
+    check_rejected(rom, "waiting for key isn't a bool", bad, bad.size());
+
+    bad = good;
+    set_field<uint64_t>(bad, offsetof(CPUState, rng), 0);
+    check_rejected(rom, "rng of zero", bad, bad.size());
+
+    /* The limits themselves are fine */
+    test_context("sp and pc at their limits");
+    std::vector<uint8_t> edge = good;
+    set_field<uint16_t>(edge, offsetof(CPUState, sp), CHIP8_STACK_DEPTH - 1);
+    set_field<uint16_t>(edge, offsetof(CPUState, pc), CHIP8_MEMORY_SIZE - 2);
+    CPU restored(rom.data(), rom.size());
+    CHECK(restored.load(edge.data(), edge.size()));
+}
+
+void test_snapshot()
+{
+    RomFile rom;
+    if (!load_example(rom, "stars.ch8")) {
+        return;
+    }
+    check_round_trip(rom);
+    check_damaged(rom);
+}
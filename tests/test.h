@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "rom.h"
+
+/*
+ * chip8test checks how the emulator core behaves. Every test is a function that reports what it
+ * found wrong through CHECK(), and chip8test runs the tests named on its command line, or all of
+ * them, so that ctest can run each one on its own.
+ */
+
+#ifndef CHIP8TEST_EXAMPLES_DIR
+    #define CHIP8TEST_EXAMPLES_DIR "examples"
+#endif
+
+/* ROMs written for the tests, see tests/roms */
+#ifndef CHIP8TEST_ROMS_DIR
+    #define CHIP8TEST_ROMS_DIR "tests/roms"
+#endif
+
+/* Where tests write their scratch files */
+#ifndef CHIP8TEST_OUTPUT_DIR
+    #define CHIP8TEST_OUTPUT_DIR "."
+#endif
+
+/* Records a failure unless 'condition' holds and evaluates to whether it did */
+#define CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+bool test_check(bool passed, const char* expression, const char* file, int line);
+
+/* Names what the test is looking at, e.g. the ROM and engine, in the failures reported after this */
+void test_context(const std::string& context);
+
+/* Reads the ROM 'name' from the examples directory, failing the test if it can't be read */
+bool load_example(RomFile& rom, const char* name);
+
+/* Reads the ROM 'name' from the test ROMs directory, failing the test if it can't be read */
+bool load_test_rom(RomFile& rom, const char* name);
+
+/* The path of the scratch file 'name' */
+std::string test_output_path(const char* name);
+
+/* A snapshot of the whole machine, for comparing two machines byte by byte */
+std::vector<uint8_t> snapshot_of(const CPU& cpu);
+
+const char* engine_name(Engine engine);
+
+void test_engines();
+void test_aot();
+void test_bank();
+void test_snapshot();
+void test_rewind();
+void test_movie();
@@ -0,0 +1,470 @@
+/*
+ * chip8-aot translates a ROM into a C++ source file that can be linked into the emulator
+ * and run with --engine=aot.
+ *
+ * The ROM is disassembled by recursive descent from CHIP8_START_ADDRESS. The reachable
+ * instructions are split into basic blocks and every block made up of instructions that
+ * only touch registers, the index and the stack is emitted as one C++ function. Everything
+ * else is left to the interpreter at run time.
+ */
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include "aot.h"
+#include "common.h"
+#include "instruction.h"
+#include "rom.h"
+
+/* The name chip8emu-aot expects the translated program to have */
+static const char* const DEFAULT_PROGRAM_NAME = "CHIP8_AOT_PROGRAM";
+
+static void show_help()
+{
+    std::cout << "chip8-aot translates a chip 8 ROM into C++ ahead of time.\n";
+    std::cout << "Usage: chip8-aot <input .rom file> <output .cpp file> [program name]\n";
+    std::cout << "The program is called " << DEFAULT_PROGRAM_NAME << " unless another name is given.\n";
+}
+
+/* Whether 'name' can be used as a C++ identifier */
+static bool is_identifier(const char* name)
+{
+    if (!std::isalpha(static_cast<unsigned char>(name[0])) && name[0] != '_') {
+        return false;
+    }
+    for (const char* c = name; *c != '\0'; ++c) {
+        if (!std::isalnum(static_cast<unsigned char>(*c)) && *c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Whether an instruction can be part of a translated block */
+static bool is_translatable(Op op)
+{
+    switch (op) {
+    case Op::RET:
+    case Op::JMP:
+    case Op::CALL:
+    case Op::SKE:
+    case Op::SKNE:
+    case Op::SKRE:
+    case Op::LOAD:
+    case Op::ADD:
+    case Op::ASN:
+    case Op::OR:
+    case Op::AND:
+    case Op::XOR:
+    case Op::RADD:
+    case Op::SUB:
+    case Op::SHR:
+    case Op::RSUB:
+    case Op::SHL:
+    case Op::SKRNE:
+    case Op::ILOAD:
+    case Op::ZJMP:
+    case Op::IADD:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Whether an instruction always transfers control somewhere other than the next instruction */
+static bool ends_block(Op op)
+{
+    switch (op) {
+    case Op::RET:
+    case Op::JMP:
+    case Op::CALL:
+    case Op::SKE:
+    case Op::SKNE:
+    case Op::SKRE:
+    case Op::SKRNE:
+    case Op::ZJMP:
+    case Op::INVALID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+class Translator {
+public:
+    explicit Translator(const RomFile& rom) : romSize(rom.size())
+    {
+        std::memset(memory, 0, sizeof(memory));
+        std::memcpy(memory + CHIP8_START_ADDRESS, rom.data(), rom.size());
+    }
+
+    void disassemble();
+    void emit(std::FILE* out, const char* romName, const char* programName) const;
+
+    size_t instructionCount() const { return code.size(); }
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    struct Block {
+        uint16_t start;
+        uint16_t end;
+        std::vector<uint16_t> successors; /* Statically known successors */
+    };
+
+    uint8_t memory[CHIP8_MEMORY_SIZE];
+    size_t romSize;
+
+    std::set<uint16_t> code;    /* Address of every reachable instruction */
+    std::set<uint16_t> leaders; /* Addresses that start a basic block */
+    std::vector<Block> blocks;  /* The translated blocks */
+
+    bool inRom(uint32_t address) const
+    {
+        return address >= CHIP8_START_ADDRESS && address + 1 < CHIP8_START_ADDRESS + romSize;
+    }
+
+    Instruction at(uint16_t address) const
+    {
+        return decode_instruction(memory[address] << 8 | memory[address + 1]);
+    }
+
+    std::vector<uint16_t> successors(uint16_t address) const;
+    void emitBlock(std::FILE* out, const Block& block) const;
+};
+
+std::vector<uint16_t> Translator::successors(uint16_t address) const
+{
+    const Instruction ins = at(address);
+    switch (ins.op) {
+    case Op::JMP:
+        return { ins.NNN };
+    case Op::CALL:
+        /* Follow the call as well as the code after it which the subroutine returns to, see execCALL() */
+        return { ins.NNN, static_cast<uint16_t>(address + 2) };
+    case Op::SKE:
+    case Op::SKNE:
+    case Op::SKRE:
+    case Op::SKRNE:
+    case Op::SKK:
+    case Op::SKNK:
+        return { static_cast<uint16_t>(address + 2), static_cast<uint16_t>(address + 4) };
+    case Op::RET:
+    case Op::ZJMP:
+    case Op::INVALID:
+        /* Only known at run time */
+        return {};
+    default:
+        return { static_cast<uint16_t>(address + 2) };
+    }
+}
+
+void Translator::disassemble()
+{
+    /* Recursive descent over every statically reachable instruction */
+    std::vector<uint16_t> work = { CHIP8_START_ADDRESS };
+    leaders.insert(CHIP8_START_ADDRESS);
+    while (!work.empty()) {
+        const uint16_t address = work.back();
+        work.pop_back();
+        if (!inRom(address) || !code.insert(address).second) {
+            continue;
+        }
+
+        const Instruction ins = at(address);
+        const std::vector<uint16_t> next = successors(address);
+        for (uint16_t target : next) {
+            /* Anything that isn't simply the next instruction of a translated run starts a block */
+            if (ends_block(ins.op) || !is_translatable(ins.op) || next.size() > 1) {
+                leaders.insert(target);
+            }
+            work.push_back(target);
+        }
+    }
+
+    /* Jump targets found later may land in the middle of a run, so split blocks at every leader */
+    for (uint16_t leader : leaders) {
+        if (code.count(leader) == 0 || !is_translatable(at(leader).op)) {
+            continue;
+        }
+
+        Block block;
+        block.start = leader;
+        uint16_t address = leader;
+        uint32_t count = 0;
+        for (;;) {
+            const Instruction ins = at(address);
+            ++count;
+            if (ends_block(ins.op)) {
+                block.successors = successors(address);
+                address += 2;
+                break;
+            }
+
+            address += 2;
+            if (count == CHIP8_AOT_MAX_BLOCK_INSTRUCTIONS) {
+                /* Sets are safe to grow while iterating and this leader is still ahead of us */
+                leaders.insert(address);
+            }
+            if (leaders.count(address) != 0 || code.count(address) == 0 || !is_translatable(at(address).op)) {
+                block.successors = { address };
+                break;
+            }
+        }
+        block.end = address;
+        blocks.push_back(block);
+    }
+}
+
+void Translator::emitBlock(std::FILE* out, const Block& block) const
+{
+    /* Work on locals so the compiler can keep registers in host registers for the whole block */
+    bool usesV[CHIP8_REGISTER_COUNT] = {};
+    bool writesV[CHIP8_REGISTER_COUNT] = {};
+    bool usesIndex = false;
+    for (uint16_t a = block.start; a < block.end; a += 2) {
+        const Instruction ins = at(a);
+        switch (ins.op) {
+        case Op::RET:
+        case Op::JMP:
+        case Op::CALL:
+            break;
+        case Op::ZJMP:
+            usesV[0] = true;
+            break;
+        case Op::SKE:
+        case Op::SKNE:
+            usesV[ins.X] = true;
+            break;
+        case Op::SKRE:
+        case Op::SKRNE:
+            /* Comparing a register against itself is folded into a constant */
+            if (ins.X != ins.Y) {
+                usesV[ins.X] = usesV[ins.Y] = true;
+            }
+            break;
+        case Op::ASN:
+            if (ins.X != ins.Y) {
+                usesV[ins.X] = usesV[ins.Y] = true;
+                writesV[ins.X] = true;
+            }
+            break;
+        case Op::OR:
+        case Op::AND:
+        case Op::XOR:
+            usesV[ins.X] = usesV[ins.Y] = true;
+            writesV[ins.X] = true;
+            break;
+        case Op::RADD:
+        case Op::SUB:
+        case Op::RSUB:
+            usesV[ins.X] = usesV[ins.Y] = usesV[0xF] = true;
+            writesV[ins.X] = writesV[0xF] = true;
+            break;
+        case Op::SHR:
+        case Op::SHL:
+            usesV[ins.X] = usesV[0xF] = true;
+            writesV[ins.X] = writesV[0xF] = true;
+            break;
+        case Op::LOAD:
+        case Op::ADD:
+            usesV[ins.X] = writesV[ins.X] = true;
+            break;
+        case Op::IADD:
+            usesV[ins.X] = true;
+            usesIndex = true;
+            break;
+        case Op::ILOAD:
+            usesIndex = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::fprintf(out, "/* 0x%04X - 0x%04X, successors:", block.start, block.end);
+    if (block.successors.empty()) {
+        std::fprintf(out, " dynamic");
+    }
+    for (uint16_t s : block.successors) {
+        std::fprintf(out, " 0x%04X", s);
+    }
+    std::fprintf(out, " */\n");
+    std::fprintf(out, "static void block_%04X(AotContext& c)\n{\n", block.start);
+
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; ++r) {
+        if (usesV[r]) {
+            std::fprintf(out, "    uint8_t v%X = c.V[0x%X];\n", r, r);
+        }
+    }
+    if (usesIndex) {
+        std::fprintf(out, "    uint16_t index = c.index;\n");
+    }
+    std::fprintf(out, "    uint16_t pc = 0x%04X;\n\n", block.end);
+
+    /* Each case mirrors the matching CPU::exec* handler, including the order of VF updates */
+    for (uint16_t a = block.start; a < block.end; a += 2) {
+        const Instruction ins = at(a);
+        const unsigned X = ins.X;
+        const unsigned Y = ins.Y;
+        std::fprintf(out, "    /* 0x%04X: %02X%02X */ ", a, memory[a], memory[a + 1]);
+        switch (ins.op) {
+        case Op::RET:
+            std::fprintf(out, "c.sp = (c.sp - 1) & 0x%X; pc = c.stack[c.sp];\n", CHIP8_STACK_MASK);
+            break;
+        case Op::JMP:
+            std::fprintf(out, "pc = 0x%04X;\n", ins.NNN);
+            break;
+        case Op::CALL:
+            std::fprintf(out, "c.stack[c.sp] = 0x%04X; c.sp = (c.sp + 1) & 0x%X; pc = 0x%04X;\n",
+                         (a + 2) & CHIP8_ADDRESS_MASK, CHIP8_STACK_MASK, ins.NNN);
+            break;
+        case Op::SKE:
+            std::fprintf(out, "pc = v%X == 0x%02X ? 0x%04X : 0x%04X;\n", X, ins.NN, a + 4, a + 2);
+            break;
+        case Op::SKNE:
+            std::fprintf(out, "pc = v%X != 0x%02X ? 0x%04X : 0x%04X;\n", X, ins.NN, a + 4, a + 2);
+            break;
+        case Op::SKRE:
+            if (X == Y) {
+                std::fprintf(out, "pc = 0x%04X;\n", a + 4);
+            } else {
+                std::fprintf(out, "pc = v%X == v%X ? 0x%04X : 0x%04X;\n", X, Y, a + 4, a + 2);
+            }
+            break;
+        case Op::SKRNE:
+            if (X == Y) {
+                std::fprintf(out, "pc = 0x%04X;\n", a + 2);
+            } else {
+                std::fprintf(out, "pc = v%X != v%X ? 0x%04X : 0x%04X;\n", X, Y, a + 4, a + 2);
+            }
+            break;
+        case Op::LOAD:
+            std::fprintf(out, "v%X = 0x%02X;\n", X, ins.NN);
+            break;
+        case Op::ADD:
+            std::fprintf(out, "v%X = static_cast<uint8_t>(v%X + 0x%02X);\n", X, X, ins.NN);
+            break;
+        case Op::ASN:
+            if (X == Y) {
+                std::fprintf(out, "/* assigns a register to itself */\n");
+            } else {
+                std::fprintf(out, "v%X = v%X;\n", X, Y);
+            }
+            break;
+        case Op::OR:
+            std::fprintf(out, "v%X |= v%X;\n", X, Y);
+            break;
+        case Op::AND:
+            std::fprintf(out, "v%X &= v%X;\n", X, Y);
+            break;
+        case Op::XOR:
+            std::fprintf(out, "v%X ^= v%X;\n", X, Y);
+            break;
+        case Op::RADD:
+            std::fprintf(out, "vF = v%X > 0xFF - v%X ? 1 : 0; v%X = static_cast<uint8_t>(v%X + v%X);\n", Y, X, X, X, Y);
+            break;
+        case Op::SUB:
+            std::fprintf(out, "vF = v%X > 0xFF - v%X ? 0 : 1; v%X = static_cast<uint8_t>(v%X - v%X);\n", Y, X, X, X, Y);
+            break;
+        case Op::RSUB:
+            std::fprintf(out, "vF = v%X > 0xFF - v%X ? 0 : 1; v%X = static_cast<uint8_t>(v%X - v%X);\n", Y, X, X, Y, X);
+            break;
+        case Op::SHR:
+            std::fprintf(out, "vF = v%X & 0x1; v%X = v%X >> 1;\n", X, X, X);
+            break;
+        case Op::SHL:
+            std::fprintf(out, "vF = 0; v%X = static_cast<uint8_t>(v%X << 1);\n", X, X);
+            break;
+        case Op::ILOAD:
+            std::fprintf(out, "index = 0x%04X;\n", ins.NNN);
+            break;
+        case Op::ZJMP:
+            std::fprintf(out, "pc = static_cast<uint16_t>((0x%04X + v0) & CHIP8_ADDRESS_MASK);\n", ins.NNN);
+            break;
+        case Op::IADD:
+            std::fprintf(out, "index = static_cast<uint16_t>(index + v%X);\n", X);
+            break;
+        default:
+            std::fprintf(out, "/* not translatable */\n");
+            break;
+        }
+    }
+
+    std::fprintf(out, "\n");
+    for (int r = 0; r < CHIP8_REGISTER_COUNT; ++r) {
+        if (writesV[r]) {
+            std::fprintf(out, "    c.V[0x%X] = v%X;\n", r, r);
+        }
+    }
+    if (usesIndex) {
+        std::fprintf(out, "    c.index = index;\n");
+    }
+    std::fprintf(out, "    c.pc = pc;\n}\n\n");
+}
+
+void Translator::emit(std::FILE* out, const char* romName, const char* programName) const
+{
+    std::fprintf(out, "/* Generated by chip8-aot from %s. Do not edit. */\n", romName);
+    std::fprintf(out, "#include \"aot.h\"\n\n");
+
+    std::fprintf(out, "static const uint8_t ROM_IMAGE[] = {");
+    for (size_t i = 0; i < romSize; ++i) {
+        std::fprintf(out, "%s0x%02X,", i % 16 == 0 ? "\n    " : " ", memory[CHIP8_START_ADDRESS + i]);
+    }
+    std::fprintf(out, "\n};\n\n");
+
+    for (const Block& block : blocks) {
+        emitBlock(out, block);
+    }
+
+    std::fprintf(out, "static const AotBlock BLOCKS[] = {\n");
+    for (const Block& block : blocks) {
+        std::fprintf(out, "    { 0x%04X, 0x%04X, %u, block_%04X },\n",
+                     block.start, block.end, (block.end - block.start) / 2u, block.start);
+    }
+    if (blocks.empty()) {
+        std::fprintf(out, "    { 0, 0, 0, nullptr },\n");
+    }
+    std::fprintf(out, "};\n\n");
+
+    std::fprintf(out, "extern const AotProgram %s;\n", programName);
+    std::fprintf(out, "const AotProgram %s = { ROM_IMAGE, sizeof(ROM_IMAGE), BLOCKS, %zu };\n", programName, blocks.size());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4 || std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0) {
+        show_help();
+        return argc == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    const char* programName = argc == 4 ? argv[3] : DEFAULT_PROGRAM_NAME;
+    if (!is_identifier(programName)) {
+        std::cerr << "'" << programName << "' can't be used as the name of the program!\n";
+        return EXIT_FAILURE;
+    }
+
+    RomFile rom;
+    const RomError error = rom.open(argv[1]);
+    if (error != RomError::None) {
+        std::cerr << "Couldn't load the ROM '" << argv[1] << "': " << rom_error_message(error) << "!\n";
+        return EXIT_FAILURE;
+    }
+
+    Translator translator(rom);
+    translator.disassemble();
+
+    std::FILE* out = std::fopen(argv[2], "w");
+    if (out == nullptr) {
+        std::cerr << "Couldn't open " << argv[2] << " for writing!\n";
+        return EXIT_FAILURE;
+    }
+    translator.emit(out, argv[1], programName);
+    std::fclose(out);
+
+    std::cout << "Translated " << translator.instructionCount() << " reachable instructions into "
+              << translator.blockCount() << " blocks.\n";
+    return EXIT_SUCCESS;
+}
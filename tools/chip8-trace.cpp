@@ -0,0 +1,91 @@
+/*
+ * chip8-trace prints a trace file written by a build of the emulator with tracing compiled in,
+ * see include/trace.h. Each thread's records are printed oldest first, one per line.
+ */
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "trace.h"
+
+static void show_help()
+{
+    std::cout << "chip8-trace prints the records in a chip8emu trace file.\n";
+    std::cout << "Usage: chip8-trace <trace file>\n";
+}
+
+static void print_record(uint32_t thread, const TraceRecord& record)
+{
+    std::printf("%2u %10u 0x%03X %-8s ", thread, record.sequence, record.pc, trace_event_name(record.event));
+    switch (record.event) {
+    case TraceEvent::Fetch:
+        std::printf("%04X", record.a);
+        break;
+    case TraceEvent::Jump:
+        std::printf("-> 0x%03X", record.a);
+        break;
+    case TraceEvent::Call:
+    case TraceEvent::Return:
+        std::printf("-> 0x%03X depth %u", record.a, record.b);
+        break;
+    case TraceEvent::Draw:
+        std::printf("x %u y %u height %u%s", record.a & 0xFF, record.a >> 8, record.b & 0xFF,
+            (record.b >> 8) ? " collision" : "");
+        break;
+    case TraceEvent::KeyWait:
+        std::printf("into V%X", record.a);
+        break;
+    case TraceEvent::KeyPress:
+        std::printf("key %X", record.a);
+        break;
+    case TraceEvent::IdleSkip:
+        std::printf("%u instructions", record.a);
+        break;
+    default:
+        break;
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2 || std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0) {
+        show_help();
+        return argc == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::FILE* file = std::fopen(argv[1], "rb");
+    if (file == nullptr) {
+        std::cerr << "Couldn't open '" << argv[1] << "'!\n";
+        return EXIT_FAILURE;
+    }
+
+    TraceFileHeader header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, "C8TR", sizeof(header.magic)) != 0 ||
+        header.version != CHIP8_TRACE_FILE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        std::cerr << "'" << argv[1] << "' isn't a trace file from this version!\n";
+        std::fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%2s %10s %5s %-8s\n", "th", "seq", "pc", "event");
+    for (uint32_t r = 0; r < header.ringCount; ++r) {
+        TraceFileRing ring;
+        if (std::fread(&ring, sizeof(ring), 1, file) != 1 || ring.count > CHIP8_TRACE_RING_SIZE) {
+            std::cerr << "'" << argv[1] << "' is truncated!\n";
+            std::fclose(file);
+            return EXIT_FAILURE;
+        }
+        std::vector<TraceRecord> records(ring.count);
+        if (std::fread(records.data(), sizeof(TraceRecord), records.size(), file) != records.size()) {
+            std::cerr << "'" << argv[1] << "' is truncated!\n";
+            std::fclose(file);
+            return EXIT_FAILURE;
+        }
+        for (const TraceRecord& record : records) {
+            print_record(ring.thread, record);
+        }
+    }
+    std::fclose(file);
+    return EXIT_SUCCESS;
+}
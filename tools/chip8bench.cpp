@@ -0,0 +1,685 @@
+/*
+ * chip8bench times the pieces of the emulator core that matter for speed: decoding, dispatch,
+ * every instruction handler, sprite drawing, whole frames, whole ROMs and ROMs in a CPUBank.
+ *
+ * Each benchmark is first calibrated until one repetition takes at least MIN_REP_SECONDS, then
+ * repeated and summarized by the median, minimum, mean and standard deviation of the time per
+ * operation. What an operation is depends on the benchmark: one instruction for the handlers
+ * and ROMs, one sprite for DXYN and one whole screen for the frame benchmarks.
+ *
+ * With --baseline the results are compared against a JSON file written earlier with --json and
+ * the run fails if any benchmark got slower than the threshold allows. The comparison uses the
+ * fastest repetition, which other processes on the machine disturb much less than the median,
+ * scaled by how fast REFERENCE_BENCHMARK ran right before it compared to the baseline. That loop
+ * doesn't touch the emulator, so it only cancels out the machine being faster or slower than it
+ * was. The chip8bench-check target does that against the baseline checked in next to this file.
+ *
+ * Every run also fails if the JIT isn't faster than the threaded engine on a ROM both of them ran,
+ * since being faster is the only reason to pick it.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "cpu_bank.h"
+#include "framebuffer.h"
+#include "headless.h"
+#include "instruction.h"
+#include "rom.h"
+#include "scheduler.h"
+
+#ifndef CHIP8BENCH_EXAMPLES_DIR
+    #define CHIP8BENCH_EXAMPLES_DIR "examples"
+#endif
+
+static const double MIN_REP_SECONDS = 0.01;
+static const uint64_t DEFAULT_REPETITIONS = 10;
+
+/* How much slower than the baseline, in percent, a benchmark may get before it counts as a regression */
+static const uint64_t DEFAULT_THRESHOLD_PERCENT = 10;
+
+/* Plain arithmetic that no change to the emulator affects, run before and after the others */
+static const char* const REFERENCE_BENCHMARK = "reference/loop";
+
+/* Further measurements a benchmark that looks slower than the baseline gets before it counts as one */
+static const int REGRESSION_RETRIES = 2;
+
+/* Copies of the instruction under test between two trips through the closing jump */
+static const uint16_t HANDLER_BODY_LENGTH = 256;
+
+/* Memory the handlers that use I point it at, well clear of the program */
+static const uint16_t SCRATCH_ADDRESS = 0xE00;
+
+/* Instances in the CPUBank benchmarks, as many as one AVX2 register holds byte registers for */
+static const size_t BANK_LANES = 32;
+
+struct Benchmark {
+    std::string name;
+    std::string unit; /* What one operation is */
+    /* Performs about 'iterations' operations and returns how many it actually did */
+    std::function<uint64_t(uint64_t iterations)> run;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    std::string unit;
+    uint64_t operations; /* Per repetition */
+    double medianNs;     /* Per operation, as are the rest */
+    double minNs;
+    double meanNs;
+    double stddevNs;
+    double scale;        /* Converts the times to the baseline machine's speed, see baseline_scale() */
+};
+
+/* Keeps the compiler from throwing away results nothing else reads */
+static volatile uint64_t sink;
+
+static void show_help()
+{
+    std::cout << "chip8bench runs microbenchmarks of the chip 8 emulator core.\n";
+    std::cout << "Usage: chip8bench [options]\n";
+    std::cout << "   --help | -h -- displays this help screen\n";
+    std::cout << "   --reps <n> -- how many timed repetitions each benchmark gets (default: " << DEFAULT_REPETITIONS << ")\n";
+    std::cout << "   --filter <text> -- only runs the benchmarks whose name contains the text\n";
+    std::cout << "   --roms <dir> -- where stars.ch8 and chip8logo.ch8 are (default: " << CHIP8BENCH_EXAMPLES_DIR << ")\n";
+    std::cout << "   --json <file> -- also writes the results as JSON, - for stdout\n";
+    std::cout << "   --baseline <file> -- compares the results with a file written by --json and fails if any got slower\n";
+    std::cout << "   --threshold <percent> -- how much slower than the baseline a benchmark may get (default: " << DEFAULT_THRESHOLD_PERCENT << ")\n";
+    std::cout << "Fails if the JIT isn't faster than the threaded engine on a ROM both ran.\n";
+}
+
+static bool parse_count(const char* text, uint64_t& count)
+{
+    char* end = nullptr;
+    const unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    count = value;
+    return true;
+}
+
+static const char* engine_name(Engine engine)
+{
+    switch (engine) {
+    case Engine::Switch:   return "switch";
+    case Engine::Threaded: return "threaded";
+    case Engine::Jit:      return "jit";
+    case Engine::Aot:      return "aot";
+    default:               return "?";
+    }
+}
+
+/* A CPU running 'program' from CHIP8_START_ADDRESS */
+static std::shared_ptr<CPU> make_cpu(const std::vector<uint16_t>& program)
+{
+    std::vector<uint8_t> rom(2 * program.size());
+    for (size_t i = 0; i < program.size(); ++i) {
+        rom[2 * i] = static_cast<uint8_t>(program[i] >> 8);
+        rom[2 * i + 1] = static_cast<uint8_t>(program[i]);
+    }
+    return std::make_shared<CPU>(rom.data(), rom.size());
+}
+
+/*
+ * A CPU running 'setup' once and then looping over HANDLER_BODY_LENGTH instructions made by
+ * 'body' (given the address of each) and a jump back, followed by 'tail'. Keeps the CPU
+ * between repetitions.
+ */
+static Benchmark loop_benchmark(const std::string& name, Engine engine, const std::vector<uint16_t>& setup,
+                                std::function<uint16_t(uint16_t address)> body,
+                                const std::vector<uint16_t>& tail = {}, uint16_t keys = 0)
+{
+    std::vector<uint16_t> program = setup;
+    const uint16_t loop = static_cast<uint16_t>(CHIP8_START_ADDRESS + 2 * program.size());
+    for (uint16_t i = 0; i < HANDLER_BODY_LENGTH; ++i) {
+        program.push_back(body(static_cast<uint16_t>(loop + 2 * i)));
+    }
+    program.push_back(0x1000 | loop);
+    program.insert(program.end(), tail.begin(), tail.end());
+
+    std::shared_ptr<CPU> cpu = make_cpu(program);
+    cpu->setEngine(engine);
+    cpu->setKeys(keys);
+    cpu->run(static_cast<uint32_t>(setup.size()));
+
+    return { name, "instruction", [cpu](uint64_t iterations) {
+        uint64_t executed = 0;
+        while (executed < iterations) {
+            executed += cpu->run(static_cast<uint32_t>(std::min<uint64_t>(iterations - executed, UINT32_MAX)));
+        }
+        return executed;
+    } };
+}
+
+/* The same instruction over and over */
+static Benchmark handler_benchmark(Op op, Engine engine, const std::vector<uint16_t>& setup, uint16_t opcode, uint16_t keys = 0)
+{
+    return loop_benchmark(std::string("handler/") + op_name(op), engine, setup, [=](uint16_t) { return opcode; }, {}, keys);
+}
+
+static void add_handler_benchmarks(std::vector<Benchmark>& benchmarks, Engine engine)
+{
+    /* V0 = 0, V1 = 1, I = SCRATCH_ADDRESS, so that none of the skips below is taken */
+    const std::vector<uint16_t> setup = { 0x6000, 0x6101, static_cast<uint16_t>(0xA000 | SCRATCH_ADDRESS) };
+    const uint16_t subroutine = static_cast<uint16_t>(CHIP8_START_ADDRESS + 2 * (setup.size() + HANDLER_BODY_LENGTH + 1));
+
+    benchmarks.push_back(handler_benchmark(Op::CLR, engine, setup, 0x00E0));
+    /* Every call goes to a RET right after the loop, so half of the instructions are returns */
+    benchmarks.push_back(loop_benchmark("handler/CALL+RET", engine, setup, [=](uint16_t) {
+        return static_cast<uint16_t>(0x2000 | subroutine);
+    }, { 0x00EE }));
+    benchmarks.push_back(loop_benchmark("handler/JMP", engine, setup, [](uint16_t address) {
+        return static_cast<uint16_t>(0x1000 | (address + 2));
+    }));
+    benchmarks.push_back(handler_benchmark(Op::SKE, engine, setup, 0x3001));
+    benchmarks.push_back(handler_benchmark(Op::SKNE, engine, setup, 0x4000));
+    benchmarks.push_back(handler_benchmark(Op::SKRE, engine, setup, 0x5010));
+    benchmarks.push_back(handler_benchmark(Op::LOAD, engine, setup, 0x6212));
+    benchmarks.push_back(handler_benchmark(Op::ADD, engine, setup, 0x7201));
+    benchmarks.push_back(handler_benchmark(Op::ASN, engine, setup, 0x8210));
+    benchmarks.push_back(handler_benchmark(Op::OR, engine, setup, 0x8211));
+    benchmarks.push_back(handler_benchmark(Op::AND, engine, setup, 0x8212));
+    benchmarks.push_back(handler_benchmark(Op::XOR, engine, setup, 0x8213));
+    benchmarks.push_back(handler_benchmark(Op::RADD, engine, setup, 0x8214));
+    benchmarks.push_back(handler_benchmark(Op::SUB, engine, setup, 0x8215));
+    benchmarks.push_back(handler_benchmark(Op::SHR, engine, setup, 0x8216));
+    benchmarks.push_back(handler_benchmark(Op::RSUB, engine, setup, 0x8217));
+    benchmarks.push_back(handler_benchmark(Op::SHL, engine, setup, 0x821E));
+    benchmarks.push_back(handler_benchmark(Op::SKRNE, engine, setup, 0x9000));
+    benchmarks.push_back(handler_benchmark(Op::ILOAD, engine, setup, static_cast<uint16_t>(0xA000 | SCRATCH_ADDRESS)));
+    benchmarks.push_back(loop_benchmark("handler/ZJMP", engine, setup, [](uint16_t address) {
+        return static_cast<uint16_t>(0xB000 | (address + 2));
+    }));
+    benchmarks.push_back(handler_benchmark(Op::RAND, engine, setup, 0xC2FF));
+    benchmarks.push_back(handler_benchmark(Op::DRAW, engine, setup, 0xD015));
+    benchmarks.push_back(handler_benchmark(Op::SKK, engine, setup, 0xE09E));
+    benchmarks.push_back(handler_benchmark(Op::SKNK, engine, setup, 0xE0A1, 0xFFFF));
+    benchmarks.push_back(handler_benchmark(Op::DELA, engine, setup, 0xF207));
+    benchmarks.push_back(handler_benchmark(Op::DELR, engine, setup, 0xF015));
+    benchmarks.push_back(handler_benchmark(Op::SNDR, engine, setup, 0xF018));
+    benchmarks.push_back(handler_benchmark(Op::IADD, engine, setup, 0xF01E));
+    benchmarks.push_back(handler_benchmark(Op::SILS, engine, setup, 0xF029));
+    benchmarks.push_back(handler_benchmark(Op::BCD, engine, setup, 0xF133));
+    benchmarks.push_back(handler_benchmark(Op::DUMP, engine, setup, 0xFF55));
+    benchmarks.push_back(handler_benchmark(Op::IDUMP, engine, setup, 0xFF65));
+    benchmarks.push_back(handler_benchmark(Op::INVALID, engine, setup, 0x5011));
+}
+
+/* DXYN at column 'x' and row 'y' with an 'height' row sprite from the font */
+static void add_sprite_benchmarks(std::vector<Benchmark>& benchmarks, Engine engine)
+{
+    static const struct {
+        uint8_t x;
+        uint8_t y;
+        const char* where;
+    } PLACES[] = {
+        { 8, 0, "aligned" },
+        { 3, 0, "unaligned" },
+        { 60, 0, "clipped-right" },
+        { 0, 24, "clipped-bottom" },
+    };
+    for (uint8_t height : { 1, 5, 15 }) {
+        for (const auto& place : PLACES) {
+            const std::vector<uint16_t> setup = { static_cast<uint16_t>(0x6000 | place.x), static_cast<uint16_t>(0x6100 | place.y), 0xA000 };
+            benchmarks.push_back(loop_benchmark("sprite/h" + std::to_string(height) + "/" + place.where, engine, setup,
+                [=](uint16_t) { return static_cast<uint16_t>(0xD010 | height); }));
+            benchmarks.back().unit = "sprite";
+        }
+    }
+}
+
+static void add_frame_benchmarks(std::vector<Benchmark>& benchmarks)
+{
+    std::shared_ptr<uint64_t> rows(new uint64_t[CHIP8_PIXELS_HEIGHT](), std::default_delete<uint64_t[]>());
+
+    /* Every pixel of the screen flipped by sprite rows, as a ROM filling the screen would */
+    benchmarks.push_back({ "frame/blit", "frame", [rows](uint64_t iterations) {
+        bool collision = false;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            for (unsigned y = 0; y < CHIP8_PIXELS_HEIGHT; ++y) {
+                for (unsigned x = 0; x < CHIP8_PIXELS_WIDTH; x += 8) {
+                    collision |= framebuffer_xor_row(rows.get(), static_cast<uint8_t>(0xA5 ^ i), x, y);
+                }
+            }
+        }
+        sink = sink + collision;
+        return iterations;
+    } });
+
+    /* Expanding the screen to a byte per pixel, which is what a renderer does with every frame */
+    benchmarks.push_back({ "frame/unpack", "frame", [rows](uint64_t iterations) {
+        uint8_t pixels[CHIP8_PIXELS_WIDTH * CHIP8_PIXELS_HEIGHT];
+        for (uint64_t i = 0; i < iterations; ++i) {
+            rows.get()[i % CHIP8_PIXELS_HEIGHT] ^= i;
+            framebuffer_unpack(rows.get(), pixels);
+            sink = sink + pixels[i % sizeof(pixels)];
+        }
+        return iterations;
+    } });
+
+    benchmarks.push_back({ "frame/hash", "frame", [rows](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            rows.get()[i % CHIP8_PIXELS_HEIGHT] ^= i;
+            sink = sink + hash_framebuffer(rows.get());
+        }
+        return iterations;
+    } });
+}
+
+static Benchmark reference_benchmark()
+{
+    return { REFERENCE_BENCHMARK, "iteration", [](uint64_t iterations) {
+        uint64_t x = 0x9E3779B97F4A7C15ULL;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+        }
+        sink = sink + x;
+        return iterations;
+    } };
+}
+
+static void add_decode_benchmarks(std::vector<Benchmark>& benchmarks)
+{
+    /* Every possible opcode */
+    benchmarks.push_back({ "decode/all-opcodes", "opcode", [](uint64_t iterations) {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            const Instruction ins = decode_instruction(static_cast<uint16_t>(i * 40503));
+            sum += static_cast<uint64_t>(ins.op) + ins.NNN;
+        }
+        sink = sink + sum;
+        return iterations;
+    } });
+
+    /* CPU::next() and CPU::decode(), which decodes an opcode and dispatches it without the instruction cache */
+    std::shared_ptr<CPU> cpu = make_cpu({ 0x6012 });
+    benchmarks.push_back({ "decode/next+decode", "instruction", [cpu](uint64_t iterations) {
+        /* Ends with a jump back so the pc stays put */
+        static const uint16_t OPCODES[] = { 0x6012, 0x7201, 0x8214, 0x8123, 0xA300, 0x8316, 0xF21E, 0x1200 };
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            sum += cpu->next();
+            cpu->decode(OPCODES[i & 7]);
+        }
+        sink = sink + sum;
+        return iterations;
+    } });
+}
+
+static void add_rom_benchmarks(std::vector<Benchmark>& benchmarks, const std::string& romDir, Engine engine)
+{
+    for (const char* name : { "stars.ch8", "chip8logo.ch8" }) {
+        const std::string path = romDir + "/" + name;
+        RomFile rom;
+        const RomError error = rom.open(path.c_str());
+        if (error != RomError::None) {
+            std::cerr << "Couldn't load '" << path << "': " << rom_error_message(error) << ", skipping it.\n";
+            continue;
+        }
+        std::shared_ptr<CPU> cpu = std::make_shared<CPU>(rom.data(), rom.size());
+        cpu->setEngine(engine);
+        std::shared_ptr<HeadlessHost> host = std::make_shared<HeadlessHost>();
+        cpu->setHost(host.get());
+        benchmarks.push_back({ std::string("rom/") + name + "/" + engine_name(engine), "instruction", [cpu, host](uint64_t iterations) {
+            return run_headless(*cpu, *host, iterations).cycles;
+        } });
+    }
+}
+
+/* Emulated 60 Hz frames of the default number of instructions, including the timer ticks and presenting */
+static void add_frame_rate_benchmarks(std::vector<Benchmark>& benchmarks, const std::string& romDir, Engine engine)
+{
+    for (const char* name : { "stars.ch8", "chip8logo.ch8" }) {
+        const std::string path = romDir + "/" + name;
+        RomFile rom;
+        if (rom.open(path.c_str()) != RomError::None) {
+            continue;
+        }
+        std::shared_ptr<CPU> cpu = std::make_shared<CPU>(rom.data(), rom.size());
+        cpu->setEngine(engine);
+        std::shared_ptr<HeadlessHost> host = std::make_shared<HeadlessHost>();
+        cpu->setHost(host.get());
+        benchmarks.push_back({ std::string("frames/") + name, "frame", [cpu, host](uint64_t iterations) {
+            return run_headless(*cpu, *host, iterations * CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME).cycles /
+                CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME;
+        } });
+    }
+}
+
+/*
+ * BANK_LANES instances of a ROM in a CPUBank, each with its own random number seed, run in 60 Hz
+ * frames. An operation is one instruction on one lane so the results compare with rom/.
+ */
+static void add_bank_benchmarks(std::vector<Benchmark>& benchmarks, const std::string& romDir)
+{
+    typedef CPUBank<BANK_LANES> Bank;
+    for (const char* name : { "stars.ch8", "chip8logo.ch8" }) {
+        const std::string path = romDir + "/" + name;
+        RomFile rom;
+        if (rom.open(path.c_str()) != RomError::None) {
+            continue;
+        }
+        std::shared_ptr<Bank> bank = std::make_shared<Bank>(rom.data(), rom.size());
+        for (size_t lane = 0; lane < BANK_LANES; ++lane) {
+            bank->setSeed(lane, lane);
+        }
+        benchmarks.push_back({ std::string("bank/") + name, "instruction", [bank](uint64_t iterations) {
+            const uint64_t perFrame = BANK_LANES * CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME;
+            const uint64_t frames = (iterations + perFrame - 1) / perFrame;
+            for (uint64_t frame = 0; frame < frames; ++frame) {
+                bank->run(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+                bank->tickTimers();
+            }
+            sink = sink + bank->getGFX(BANK_LANES - 1)[0];
+            return frames * perFrame;
+        } });
+    }
+}
+
+/* Everything between being handed a ROM path and the end of the first frame */
+static void add_startup_benchmarks(std::vector<Benchmark>& benchmarks, const std::string& romDir, Engine engine)
+{
+    for (const char* name : { "stars.ch8", "chip8logo.ch8" }) {
+        const std::string path = romDir + "/" + name;
+        benchmarks.push_back({ std::string("startup/") + name, "start", [path, engine](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                RomFile rom;
+                if (rom.open(path.c_str()) != RomError::None) {
+                    return i;
+                }
+                CPU cpu(rom.data(), rom.size());
+                cpu.setEngine(engine);
+                cpu.runFrame(CHIP8_DEFAULT_INSTRUCTIONS_PER_FRAME);
+                sink = sink + cpu.getGFX()[0];
+            }
+            return iterations;
+        } });
+    }
+}
+
+static double elapsed_ns(const std::function<uint64_t(uint64_t)>& run, uint64_t iterations, uint64_t& operations)
+{
+    const auto start = std::chrono::steady_clock::now();
+    operations = run(iterations);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static BenchmarkResult measure(const Benchmark& benchmark, uint64_t repetitions)
+{
+    /* Grow the repetition until it's long enough for the clock, which also warms everything up */
+    uint64_t iterations = 1024;
+    uint64_t operations = 0;
+    while (elapsed_ns(benchmark.run, iterations, operations) < MIN_REP_SECONDS * 1e9 && operations == iterations) {
+        iterations *= 2;
+    }
+
+    std::vector<double> samples;
+    for (uint64_t r = 0; r < repetitions; ++r) {
+        const double ns = elapsed_ns(benchmark.run, iterations, operations);
+        samples.push_back(ns / std::max<uint64_t>(operations, 1));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchmarkResult result;
+    result.name = benchmark.name;
+    result.unit = benchmark.unit;
+    result.operations = operations;
+    result.medianNs = samples.size() % 2 ? samples[samples.size() / 2]
+                                         : (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+    result.minNs = samples.front();
+    double sum = 0;
+    for (double s : samples) {
+        sum += s;
+    }
+    result.meanNs = sum / samples.size();
+    double squares = 0;
+    for (double s : samples) {
+        squares += (s - result.meanNs) * (s - result.meanNs);
+    }
+    result.stddevNs = samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0.0;
+    result.scale = 1.0;
+    return result;
+}
+
+/* Million operations per second at the median, emulated MIPS for the instruction benchmarks */
+static double mops(const BenchmarkResult& result)
+{
+    return result.medianNs > 0 ? 1e3 / result.medianNs : 0.0;
+}
+
+static bool write_json(const std::vector<BenchmarkResult>& results, uint64_t repetitions, const char* path)
+{
+    std::FILE* out = std::strcmp(path, "-") == 0 ? stdout : std::fopen(path, "w");
+    if (out == nullptr) {
+        return false;
+    }
+    std::fprintf(out, "{\n  \"repetitions\": %llu,\n  \"benchmarks\": [\n", static_cast<unsigned long long>(repetitions));
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        std::fprintf(out,
+            "    {\"name\": \"%s\", \"unit\": \"%s\", \"operations\": %llu, \"median_ns\": %.3f, \"min_ns\": %.3f, "
+            "\"mean_ns\": %.3f, \"stddev_ns\": %.3f, \"mops\": %.3f}%s\n",
+            r.name.c_str(), r.unit.c_str(), static_cast<unsigned long long>(r.operations), r.medianNs, r.minNs,
+            r.meanNs, r.stddevNs, mops(r), i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+    return out == stdout ? std::fflush(out) == 0 : std::fclose(out) == 0;
+}
+
+/* Reads the fastest repetition of every benchmark in a file written by write_json() */
+static bool read_baseline(const char* path, std::map<std::string, double>& baseline)
+{
+    std::FILE* file = std::fopen(path, "r");
+    if (file == nullptr) {
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    size_t read = 0;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, read);
+    }
+    std::fclose(file);
+
+    static const std::string NAME_KEY = "\"name\": \"";
+    static const std::string MIN_KEY = "\"min_ns\": ";
+    for (size_t at = text.find(NAME_KEY); at != std::string::npos; at = text.find(NAME_KEY, at)) {
+        at += NAME_KEY.size();
+        const size_t nameEnd = text.find('"', at);
+        const size_t min = text.find(MIN_KEY, at);
+        const size_t objectEnd = text.find('}', at);
+        if (nameEnd == std::string::npos || min == std::string::npos || min > objectEnd) {
+            return false;
+        }
+        baseline[text.substr(at, nameEnd - at)] = std::strtod(text.c_str() + min + MIN_KEY.size(), nullptr);
+    }
+    return !baseline.empty();
+}
+
+static double percent_change(double ns, double baselineNs)
+{
+    return 100.0 * (ns - baselineNs) / baselineNs;
+}
+
+static bool is_regression(const BenchmarkResult& result, const std::map<std::string, double>& baseline, uint64_t thresholdPercent)
+{
+    const auto found = baseline.find(result.name);
+    return found != baseline.end() && found->second > 0 && result.name != REFERENCE_BENCHMARK &&
+        percent_change(result.minNs * result.scale, found->second) > static_cast<double>(thresholdPercent);
+}
+
+/* How much faster the reference loop ran for the baseline than it does now, 1 if the baseline has no reference */
+static double baseline_scale(const Benchmark& reference, const std::map<std::string, double>& baseline, uint64_t repetitions)
+{
+    const auto found = baseline.find(REFERENCE_BENCHMARK);
+    if (found == baseline.end() || found->second <= 0) {
+        return 1.0;
+    }
+    const double referenceNs = measure(reference, repetitions).minNs;
+    return referenceNs > 0 ? found->second / referenceNs : 1.0;
+}
+
+/* Prints how every result compares to the baseline and returns how many regressed */
+static size_t compare_with_baseline(const std::vector<BenchmarkResult>& results, const std::map<std::string, double>& baseline,
+                                    uint64_t thresholdPercent, std::FILE* out)
+{
+    size_t regressions = 0;
+    std::fprintf(out, "\nCurrent times are scaled to the speed the machine had for the baseline, see the scale column.\n");
+    std::fprintf(out, "%-32s %12s %12s %9s %7s\n", "benchmark", "baseline min", "current min", "change", "scale");
+    for (const BenchmarkResult& r : results) {
+        if (r.name == REFERENCE_BENCHMARK) {
+            continue;
+        }
+        const auto found = baseline.find(r.name);
+        if (found == baseline.end() || found->second <= 0) {
+            std::fprintf(out, "%-32s %12s %12.2f %9s %7.2f  new\n", r.name.c_str(), "-", r.minNs * r.scale, "", r.scale);
+            continue;
+        }
+        const double change = percent_change(r.minNs * r.scale, found->second);
+        const bool regressed = is_regression(r, baseline, thresholdPercent);
+        regressions += regressed;
+        std::fprintf(out, "%-32s %12.2f %12.2f %+8.1f%% %7.2f%s\n", r.name.c_str(), found->second, r.minNs * r.scale, change, r.scale,
+            regressed ? "  REGRESSED" : (change < -static_cast<double>(thresholdPercent) ? "  faster" : ""));
+    }
+    if (regressions != 0) {
+        std::fprintf(out, "%zu of %zu benchmarks are more than %llu%% slower than the baseline!\n",
+            regressions, results.size() - 1, static_cast<unsigned long long>(thresholdPercent));
+    } else {
+        std::fprintf(out, "No benchmark is more than %llu%% slower than the baseline.\n", static_cast<unsigned long long>(thresholdPercent));
+    }
+    return regressions;
+}
+
+/* Returns how many ROMs the JIT ran no faster than the threaded engine did, judged by the fastest repetitions */
+static size_t compare_jit_with_threaded(const std::vector<BenchmarkResult>& results, std::FILE* out)
+{
+    const std::string jitSuffix = std::string("/") + engine_name(Engine::Jit);
+    const std::string threadedSuffix = std::string("/") + engine_name(Engine::Threaded);
+
+    size_t slower = 0;
+    for (const BenchmarkResult& jit : results) {
+        if (jit.name.compare(0, 4, "rom/") != 0 || jit.name.size() < jitSuffix.size() ||
+            jit.name.compare(jit.name.size() - jitSuffix.size(), jitSuffix.size(), jitSuffix) != 0) {
+            continue;
+        }
+        const std::string threadedName = jit.name.substr(0, jit.name.size() - jitSuffix.size()) + threadedSuffix;
+        const auto threaded = std::find_if(results.begin(), results.end(), [&](const BenchmarkResult& r) {
+            return r.name == threadedName;
+        });
+        if (threaded != results.end() && jit.minNs >= threaded->minNs) {
+            std::fprintf(out, "%s takes %.2f ns, which is no faster than %.2f ns for %s!\n",
+                jit.name.c_str(), jit.minNs, threaded->minNs, threadedName.c_str());
+            ++slower;
+        }
+    }
+    return slower;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t repetitions = DEFAULT_REPETITIONS;
+    const char* filter = nullptr;
+    const char* jsonPath = nullptr;
+    const char* baselinePath = nullptr;
+    uint64_t thresholdPercent = DEFAULT_THRESHOLD_PERCENT;
+    std::string romDir = CHIP8BENCH_EXAMPLES_DIR;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+            show_help();
+            return EXIT_SUCCESS;
+        } else if (std::strcmp(argv[i], "--reps") == 0) {
+            if (i + 1 >= argc || !parse_count(argv[i + 1], repetitions) || repetitions == 0) {
+                std::cerr << "--reps expects a positive number!\n";
+                return EXIT_FAILURE;
+            }
+            ++i;
+        } else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--roms") == 0 && i + 1 < argc) {
+            romDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--threshold") == 0) {
+            if (i + 1 >= argc || !parse_count(argv[i + 1], thresholdPercent)) {
+                std::cerr << "--threshold expects a percentage!\n";
+                return EXIT_FAILURE;
+            }
+            ++i;
+        } else {
+            show_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Read first so that a bad path fails before minutes of benchmarking */
+    std::map<std::string, double> baseline;
+    if (baselinePath != nullptr && !read_baseline(baselinePath, baseline)) {
+        std::cerr << "Couldn't read any results from the baseline '" << baselinePath << "'!\n";
+        return EXIT_FAILURE;
+    }
+
+    const Engine interpreter = CPU::hasEngine(Engine::Threaded) ? Engine::Threaded : Engine::Switch;
+    std::vector<Benchmark> benchmarks;
+    benchmarks.push_back(reference_benchmark());
+    add_decode_benchmarks(benchmarks);
+    add_handler_benchmarks(benchmarks, interpreter);
+    add_sprite_benchmarks(benchmarks, interpreter);
+    add_frame_benchmarks(benchmarks);
+    for (Engine engine : { Engine::Switch, Engine::Threaded, Engine::Jit }) {
+        if (CPU::hasEngine(engine)) {
+            add_rom_benchmarks(benchmarks, romDir, engine);
+        }
+    }
+    add_frame_rate_benchmarks(benchmarks, romDir, interpreter);
+    add_bank_benchmarks(benchmarks, romDir);
+    add_startup_benchmarks(benchmarks, romDir, interpreter);
+
+    /* The table goes to stderr when the JSON goes to stdout */
+    std::FILE* table = jsonPath != nullptr && std::strcmp(jsonPath, "-") == 0 ? stderr : stdout;
+    std::fprintf(table, "handlers and sprites run on the %s engine, %llu repetitions each\n",
+        engine_name(interpreter), static_cast<unsigned long long>(repetitions));
+    std::fprintf(table, "%-32s %-12s %10s %10s %10s %9s\n", "benchmark", "unit", "median ns", "min ns", "stddev", "M/s");
+    /* The reference always runs so that every JSON file can serve as a baseline */
+    const Benchmark reference = reference_benchmark();
+    std::vector<BenchmarkResult> results;
+    for (const Benchmark& benchmark : benchmarks) {
+        if (filter != nullptr && benchmark.name.find(filter) == std::string::npos && benchmark.name != REFERENCE_BENCHMARK) {
+            continue;
+        }
+        results.push_back(measure(benchmark, repetitions));
+        results.back().scale = baseline_scale(reference, baseline, repetitions);
+        /* A busy machine makes anything look slower for a while, so make sure before blaming the code */
+        for (int retry = 0; retry < REGRESSION_RETRIES && is_regression(results.back(), baseline, thresholdPercent); ++retry) {
+            BenchmarkResult again = measure(benchmark, repetitions);
+            again.scale = baseline_scale(reference, baseline, repetitions);
+            if (again.minNs * again.scale < results.back().minNs * results.back().scale) {
+                results.back() = again;
+            }
+        }
+        const BenchmarkResult& r = results.back();
+        std::fprintf(table, "%-32s %-12s %10.2f %10.2f %10.2f %9.1f\n",
+            r.name.c_str(), r.unit.c_str(), r.medianNs, r.minNs, r.stddevNs, mops(r));
+        std::fflush(table);
+    }
+
+    if (jsonPath != nullptr && !write_json(results, repetitions, jsonPath)) {
+        std::cerr << "Couldn't write '" << jsonPath << "'!\n";
+        return EXIT_FAILURE;
+    }
+    const bool regressed = baselinePath != nullptr && compare_with_baseline(results, baseline, thresholdPercent, table) != 0;
+    const bool jitSlower = compare_jit_with_threaded(results, table) != 0;
+    return regressed || jitSlower ? EXIT_FAILURE : EXIT_SUCCESS;
+}